@@ -8,18 +8,185 @@
 //  Scores a series of 1, 2 or 3 peptides based on length, propensity and pairwise amino acid interactions.
 //  Produces Tm scores for all canonical registers. Highlights the best, second best and specificity of the system.
 //  Writes a summary to output.txt.
+//  Run with --help for the command line options that replace the questions on the standard input.
 
 
 #include <iostream>
 #include <string>
 #include <fstream>
 #include <stdlib.h>
+#include <stdio.h>
 #include <thread>
 #include <time.h>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <map>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <chrono>
+#include <random>
+#include <sstream>
+#include <string.h>
+#if defined(__unix__) || defined(__APPLE__)
+#define SCEPTTR_MMAP
+#define SCEPTTR_SOCKETS
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
-struct parameterType
+// // // // // // // // // // //
+// Profiling
+// // // // // // // // // // //
+// Built with -DSCEPTTR_PROFILE, the phases below are timed with steady_clock spans and counted by every thread in
+// counters of its own, and --profile text or --profile json writes their sum to the standard error when the program
+// ends. Spans nest: ScoreHelix includes its window, register and ranking phases. A span costs about two clock reads,
+// so the phases run for every register (its propensity, each pair thread solved and PairWiseCalc) are only counted.
+// Without SCEPTTR_PROFILE PROFILE_SPAN and PROFILE_COUNT compile to nothing.
+#ifdef SCEPTTR_PROFILE
+enum profilePhase
+{
+    profileReadParameters, profileReadLibrary, profileReadHelix, profileScoreHelix, profileWindows, profileScoreRegisters,
+    profileRegisterPropensity, profilePairThread, profileRankRegisters, profilePairWiseCalc, profilePoolRun, profileOptimizerTrial, profileOutput, numProfilePhases
+};
+// items counts what each call worked on: Yaa positions for a pair thread and PairWiseCalc (lastPair+1), tasks for a pool
+// run, helices rescored for a trial and bytes written for output.
+const string profilePhaseName[numProfilePhases] = {"ReadParameters", "readLibrary", "ReadHelix", "ScoreHelix", "WindowPropensities", "ScoreRegisters",
+    "RegisterPropensity", "SolvePairThread", "RankRegisters", "PairWiseCalc", "WorkerPool::Run", "optimizer trial", "output"};
+
+// Only the thread that owns a block writes to it, so relaxed loads and stores are enough and nothing waits.
+struct profileCounters
+{
+    atomic<long long>   calls[numProfilePhases];
+    atomic<long long>   items[numProfilePhases];
+    atomic<long long>   nanoseconds[numProfilePhases];
+    
+    profileCounters ()
+    {
+        for (short k=0;k<numProfilePhases;k++)
+        {
+            calls[k] = 0;
+            items[k] = 0;
+            nanoseconds[k] = 0;
+        }
+    }
+    
+    void add (profilePhase phase, long long moreItems, long long moreNanoseconds)
+    {
+        calls[phase].store(calls[phase].load(memory_order_relaxed) + 1, memory_order_relaxed);
+        items[phase].store(items[phase].load(memory_order_relaxed) + moreItems, memory_order_relaxed);
+        nanoseconds[phase].store(nanoseconds[phase].load(memory_order_relaxed) + moreNanoseconds, memory_order_relaxed);
+    }
+};
+
+// Every thread's counters, kept until the report at the end of the program even if the thread ended earlier.
+struct profileReport
+{
+    string                                  format = "";    // "text" or "json", "" for no report
+    mutex                                   lock;
+    vector< unique_ptr<profileCounters> >   threads;
+    
+    profileCounters * join (void)
+    {
+        lock_guard<mutex> guard(lock);
+        threads.push_back(unique_ptr<profileCounters>(new profileCounters));
+        return threads.back().get();
+    }
+    
+    ~profileReport ()
+    {
+        long long calls[numProfilePhases], items[numProfilePhases], nanoseconds[numProfilePhases];
+        short k;
+        size_t t;
+        
+        if (format == "") return;
+        lock_guard<mutex> guard(lock);
+        for (k=0;k<numProfilePhases;k++)
+        {
+            calls[k] = 0;
+            items[k] = 0;
+            nanoseconds[k] = 0;
+            for (t=0;t<threads.size();t++)
+            {
+                calls[k] += threads[t]->calls[k].load(memory_order_relaxed);
+                items[k] += threads[t]->items[k].load(memory_order_relaxed);
+                nanoseconds[k] += threads[t]->nanoseconds[k].load(memory_order_relaxed);
+            }
+        }
+        if (format == "json")
+        {
+            cerr << "{\"threads\":" << threads.size() << ",\"phases\":[";
+            for (k=0;k<numProfilePhases;k++)
+            {
+                if (k > 0) cerr << ",";
+                cerr << "{\"phase\":\"" << profilePhaseName[k] << "\",\"calls\":" << calls[k] << ",\"items\":" << items[k] << ",\"seconds\":" << nanoseconds[k] / 1.0e9 << "}";
+            }
+            cerr << "]}" << endl;
+            return;
+        }
+        cerr << "Profile of " << threads.size() << " threads (seconds are summed over the threads):" << endl;
+        cerr << "phase\tcalls\titems\tseconds\tus per call" << endl;
+        for (k=0;k<numProfilePhases;k++)
+        {
+            if (calls[k] == 0) continue;
+            // Phases that are only counted have no time.
+            cerr << profilePhaseName[k] << "\t" << calls[k] << "\t" << items[k];
+            if (nanoseconds[k] > 0) cerr << "\t" << nanoseconds[k] / 1.0e9 << "\t" << nanoseconds[k] / 1.0e3 / calls[k];
+            cerr << endl;
+        }
+    }
+};
+profileReport profiler;
+
+profileCounters & ThreadProfile (void)
+{
+    thread_local profileCounters * counters = profiler.join();
+    return *counters;
+}
+
+// Times the rest of the enclosing block as one call of phase.
+struct profileSpan
+{
+    profilePhase                        phase;
+    long long                           items;
+    chrono::steady_clock::time_point    start;
+    
+    profileSpan (profilePhase thePhase, long long theItems = 0) : phase(thePhase), items(theItems), start(chrono::steady_clock::now()) {}
+    
+    ~profileSpan ()
+    {
+        ThreadProfile().add(phase, items, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+    }
+};
+
+#define PROFILE_JOIN(name, line) name##line
+#define PROFILE_NAME(name, line) PROFILE_JOIN(name, line)
+#define PROFILE_SPAN(...) profileSpan PROFILE_NAME(profiled, __LINE__)(__VA_ARGS__)
+#define PROFILE_COUNT(phase, items) ThreadProfile().add(phase, items, 0)
+#else
+#define PROFILE_SPAN(...)
+#define PROFILE_COUNT(phase, items)
+#endif
+
+// The live scoring tables. This is everything ScoreHelix reads, kept apart from the optimizer's data
+// so scoring only ever touches these few tables and is handed them by reference.
+struct scoringParameters
 {
     double axial[27][27]; // 0 is undefined. 1 is "A", 26 is "Z".
     double lateral[27][27];
@@ -29,7 +196,21 @@ struct parameterType
     double charge;
     double Nterm;
     double Cterm;
-    
+    unsigned long version; // changes whenever any value above does, see NextParameterVersion
+};
+
+// Every set of scoring values gets its own version number, so scores remembered for one set (scoreCache) are never used with another.
+// Anything that changes a scoring value, including in a copy, must give the parameters a new version.
+atomic<unsigned long> parameterVersions(0);
+
+unsigned long NextParameterVersion (void)
+{
+    return ++parameterVersions;
+}
+
+// The scoring tables plus what only the optimizer needs: which values it may change and the experimental values it must stay near.
+struct parameterType : scoringParameters
+{
     // These are true if we want to optimize them.
     bool    optLength;
     bool    optPropX[27];
@@ -53,7 +234,9 @@ struct parameterType
 // It returns a double containing the maximum possible change in Tm from pairwise
 // interactions from that start point of the call through to the end of the peptide strand.
 // The final return should be the total maximum pairwise interactions from that strand.
-double PairWiseCalc (double XPW[], double LPW[], short currentPair, short lastPair, short previousPWType, double currentPWSum, double BestPWTotal)
+// It tries every none/lateral/axial choice (roughly 3^numYaa calls) and is no longer used for scoring.
+// It is kept as the reference that PairWiseCalc is checked against (see CheckPairWiseCalc).
+double PairWiseCalcRecursive (double XPW[], double LPW[], short currentPair, short lastPair, short previousPWType, double currentPWSum, double BestPWTotal)
 {
     bool NoPairT = false;
     bool AxPairT = false;
@@ -78,7 +261,7 @@ double PairWiseCalc (double XPW[], double LPW[], short currentPair, short lastPa
         NoPairT = true;
                 
         // "We need to go deeper!"
-        BestPWTotal = PairWiseCalc(XPW, LPW, (currentPair +1), lastPair, 0 /* the previous is no pair or zero */, currentPWSum, BestPWTotal);
+        BestPWTotal = PairWiseCalcRecursive(XPW, LPW, (currentPair +1), lastPair, 0 /* the previous is no pair or zero */, currentPWSum, BestPWTotal);
     }
         
     if ((not LatPairT) && (previousPWType != 2))
@@ -96,7 +279,7 @@ double PairWiseCalc (double XPW[], double LPW[], short currentPair, short lastPa
          LatPairT = true;
                   
      // "We need to go deeper!"
-     BestPWTotal = PairWiseCalc(XPW, LPW, (currentPair +1), lastPair, 1 /* the previous is lateral or one */, currentPWSum, BestPWTotal);
+     BestPWTotal = PairWiseCalcRecursive(XPW, LPW, (currentPair +1), lastPair, 1 /* the previous is lateral or one */, currentPWSum, BestPWTotal);
     }
             
     if (not AxPairT)
@@ -114,12 +297,203 @@ double PairWiseCalc (double XPW[], double LPW[], short currentPair, short lastPa
         AxPairT = true;
         
         // "We need to go deeper!"
-        BestPWTotal = PairWiseCalc(XPW, LPW, (currentPair +1), lastPair, 2 /* the previous is axial or two */, currentPWSum, BestPWTotal);
+        BestPWTotal = PairWiseCalcRecursive(XPW, LPW, (currentPair +1), lastPair, 2 /* the previous is axial or two */, currentPWSum, BestPWTotal);
     }
     //cout << "terminal return" << endl;
     return BestPWTotal;
 }
 
+// When enabled every call to PairWiseCalc also runs PairWiseCalcRecursive and counts any disagreement.
+// Only used by CheckPairWiseCalc, which scores one helix at a time.
+struct pairWiseCheckType
+{
+    bool    enabled;
+    long    calls;
+    long    mismatches;
+    double  worstDifference;
+};
+pairWiseCheckType pairWiseCheck = {false, 0, 0, 0};
+
+// Returns the maximum possible change in Tm from stabilizing pairwise interactions along one interaction thread,
+// using the same rules as PairWiseCalcRecursive:
+// a "no pair" may not follow a "no pair", a lateral may not follow an axial, and an axial that does not follow
+// an axial keeps the lateral of the same Yaa as well.
+// Only the best running sum ending in each previous interaction type (none, lateral, axial) is carried from one
+// Yaa to the next, so the thread is solved in a single pass over currentPair = 0..lastPair instead of 3^numYaa calls.
+// Sums are built left to right exactly as in the recursion, so the maxima are identical and not just close.
+double PairWiseCalc (double XPW[], double LPW[], short lastPair)
+{
+    const double impossible = -1.0e9; // no choice sequence ends in this interaction type
+    double noneSum, latSum, axSum;
+    double notAxialSum, latGain, axGain, newNone, newLat, newAx;
+    double BestPWTotal = 0;
+    short currentPair;
+    
+    PROFILE_COUNT(profilePairWiseCalc, lastPair + 1);
+    if (lastPair < 0) return BestPWTotal;
+    
+    // The recursion starts with a previous type of 9 which, like a lateral, allows all three choices.
+    noneSum = impossible;
+    latSum = 0;
+    axSum = impossible;
+    
+    for (currentPair=0; currentPair<lastPair; currentPair++)
+    {
+        // only sum stabilizing interactions. All possible destabilizing intereactions will be accounted for elsewhere.
+        latGain = 0;
+        axGain = 0;
+        if (LPW[currentPair] > 0) latGain = LPW[currentPair];
+        if (XPW[currentPair] > 0) axGain = XPW[currentPair];
+        
+        if (noneSum > latSum) notAxialSum = noneSum; else notAxialSum = latSum;
+        if (latSum > axSum) newNone = latSum; else newNone = axSum;
+        newLat = notAxialSum + latGain;
+        if ((newLat + axGain) > (axSum + axGain)) newAx = newLat + axGain; else newAx = axSum + axGain;
+        
+        noneSum = newNone;
+        latSum = newLat;
+        axSum = newAx;
+    }
+    
+    // At the last pair the recursion stops at the first choice it is allowed to make:
+    // nothing more is added unless the previous choice was "no pair", in which case the lateral is taken.
+    latGain = 0;
+    if (LPW[lastPair] > 0) latGain = LPW[lastPair];
+    if (latSum > BestPWTotal) BestPWTotal = latSum;
+    if (axSum > BestPWTotal) BestPWTotal = axSum;
+    if ((noneSum + latGain) > BestPWTotal) BestPWTotal = noneSum + latGain;
+    
+    if (pairWiseCheck.enabled)
+    {
+        double reference = PairWiseCalcRecursive(XPW, LPW, 0, lastPair, 9, 0, 0);
+        pairWiseCheck.calls++;
+        if (reference != BestPWTotal)
+        {
+            pairWiseCheck.mismatches++;
+            if (abs(reference - BestPWTotal) > pairWiseCheck.worstDifference) pairWiseCheck.worstDifference = abs(reference - BestPWTotal);
+        }
+    }
+    
+    return BestPWTotal;
+}
+
+// Which interactions PairWiseCalc summed for its maximum: used[i] is 1 if the lateral of Yaa i was taken, 2 if the axial
+// was and 3 for both, for i = 0..lastPair. The running sums are compared in the same order as in PairWiseCalc so ties
+// are broken the same way, and the stabilizing values of the choices add up to its result. Used by RegisterFeatures.
+void PairWiseChoice (const double XPW[], const double LPW[], short lastPair, short used[])
+{
+    const double impossible = -1.0e9; // no choice sequence ends in this interaction type
+    double noneSum, latSum, axSum;
+    double notAxialSum, latGain, axGain, newNone, newLat, newAx;
+    double BestPWTotal = 0;
+    short currentPair, state;
+    // The interaction type (0 none, 1 lateral, 2 axial) before each running sum, and whether an axial kept the lateral of its Yaa too.
+    short noneFrom[20], latFrom[20], axFrom[20];
+    bool axKeepsLateral[20];
+    
+    for (currentPair=0;currentPair<=lastPair;currentPair++) used[currentPair] = 0;
+    if (lastPair < 0) return;
+    
+    noneSum = impossible;
+    latSum = 0;
+    axSum = impossible;
+    
+    for (currentPair=0; currentPair<lastPair; currentPair++)
+    {
+        latGain = 0;
+        axGain = 0;
+        if (LPW[currentPair] > 0) latGain = LPW[currentPair];
+        if (XPW[currentPair] > 0) axGain = XPW[currentPair];
+    
+        if (noneSum > latSum)
+        {
+            notAxialSum = noneSum;
+            latFrom[currentPair] = 0;
+        }
+        else
+        {
+            notAxialSum = latSum;
+            latFrom[currentPair] = 1;
+        }
+        if (latSum > axSum)
+        {
+            newNone = latSum;
+            noneFrom[currentPair] = 1;
+        }
+        else
+        {
+            newNone = axSum;
+            noneFrom[currentPair] = 2;
+        }
+        newLat = notAxialSum + latGain;
+        if ((newLat + axGain) > (axSum + axGain))
+        {
+            newAx = newLat + axGain;
+            axFrom[currentPair] = latFrom[currentPair];
+            axKeepsLateral[currentPair] = true;
+        }
+        else
+        {
+            newAx = axSum + axGain;
+            axFrom[currentPair] = 2;
+            axKeepsLateral[currentPair] = false;
+        }
+    
+        noneSum = newNone;
+        latSum = newLat;
+        axSum = newAx;
+    }
+    
+    latGain = 0;
+    if (LPW[lastPair] > 0) latGain = LPW[lastPair];
+    state = -1; // nothing beat a total of zero
+    if (latSum > BestPWTotal)
+    {
+        BestPWTotal = latSum;
+        state = 1;
+    }
+    if (axSum > BestPWTotal)
+    {
+        BestPWTotal = axSum;
+        state = 2;
+    }
+    if ((noneSum + latGain) > BestPWTotal)
+    {
+        BestPWTotal = noneSum + latGain;
+        state = 0;
+        used[lastPair] = 1;
+    }
+    
+    // Walk the choices back from the last Yaa.
+    for (currentPair=lastPair-1;(currentPair>=0) && (state>=0);currentPair--)
+    {
+        if (state == 0)
+        {
+            state = noneFrom[currentPair];
+        }
+        else if (state == 1)
+        {
+            used[currentPair] = 1;
+            state = latFrom[currentPair];
+        }
+        else
+        {
+            if (axKeepsLateral[currentPair]) used[currentPair] = 3; else used[currentPair] = 2;
+            state = axFrom[currentPair];
+        }
+    }
+}
+
+
+// Extra shift, in residues, of the middle and trailing strands for each of the nine offsets listed in TripleHelix.
+// The strands are scored over the residues they have in common, so an offset of 3 or 6 trims that many residues
+// from the start of the other strands and from the end of the shifted one.
+const short offsetMidShift[9]   = {0, 0, 3, 3, 0, 3, 6, 6, 6};
+const short offsetTrailShift[9] = {0, 3, 0, 3, 6, 6, 0, 3, 6};
+const string offsetName[9] = {"{012}", "{015}", "{042}", "{045}", "{018}", "{048}", "{072}", "{075}", "{078}"};
+
+// Termination of either end of a helix. Only charged (free amine "n", free carboxylate "c", either case) termini are penalized.
+enum terminusType { chargedTerminus, cappedTerminus };
 
 struct TripleHelix
 {
@@ -127,6 +501,7 @@ struct TripleHelix
     short   numAA;
     char    sequences[3][100];
     string  Nterm, Cterm;
+    terminusType NtermType, CtermType; // Nterm and Cterm as set by encode()
     
     double  expTm;
     double  CCTm; // Tm of the "correct" composition. For A2B systems this requires at least one of each peptide (no homotrimers). For ABC systems this requires one of each peptide (no homotrimers and no A2B systems).
@@ -159,7 +534,10 @@ struct TripleHelix
     // 6) {072} -2 triplets.    middle strand offset by 6
     // 7) {075} -2 triplets.    middle strand offset by 6, trailing by 3
     // 8) {078} -2 triplets.    middle and trailing strand offset by 6
-    // Scoring will be handled by trimming the helix down to a canonical triple helix and then scoring based on this new smaller helix.
+    // Scoring treats the residues the three strands have in common as a smaller canonical triple helix.
+    // Only the canonical offset is scored unless ScoreHelix is asked for all offsets.
+    short   numOffsets; // 1 if only the canonical offset was scored, 9 if all offsets were.
+    bool    fullTable;  // false if some registers were left at an upper bound of their Tm (topTwoScoring).
         
     double  bestPropensity;
     double  bestPairwise;
@@ -169,6 +547,26 @@ struct TripleHelix
     
     short   XaaPos; // The position of the first Xaa amino acid.
     
+    // Precomputed by encode() (called from determine_reptition) whenever the sequences change.
+    // Scoring works from these rather than from the characters in sequences.
+    unsigned char residue[3][100];      // sequences[p][x]-64. 1 is "A", 26 is "Z".
+    unsigned char phase[100];           // 0 Xaa, 1 Yaa, 2 Gly
+    int     propensityIndex[3][100];    // residue + 27*phase into the propensity table of ScoreHelix, Gly is entry 54 (zero)
+    short   numYaaPos;
+    short   YaaList[34];                // position of each Yaa
+    // Net and total charge of each window of each peptide: the window starting s triplets in after trimming t triplets, [peptide][t][s].
+    short   windowNetCharge[3][3][3];
+    short   windowTotalCharge[3][3][3];
+    // Canonical interaction threads of each ordered pair of peptides, as flat indices (27*Yaa + partner) into the
+    // axial and lateral tables, -1 where there is no partner. [0] is the form of the first and second threads, [1] of the third.
+    short   threadAxialIndex[2][3][3][20];
+    short   threadLateralIndex[2][3][3][20];
+    // The number of each peptide in the peptidePoolType of its library, and which pool that was (its serial, 0 for none).
+    // Cleared by encode(), so a peptide that was changed is never taken for the one it was, and renumbered by a library
+    // it is copied into.
+    long            peptideID[3];
+    unsigned long   peptidePool;
+    
     void initializeAll(void)
     {
         short a,b,c,d;
@@ -183,8 +581,14 @@ struct TripleHelix
         CCTm = 0;
         numPep = 0;
         numAA = 0;
+        numOffsets = 1;
+        fullTable = true;
+        for (a=0;a<3;a++) peptideID[a] = -1;
+        peptidePool = 0;
         Nterm = "initial";
         Cterm = "initial";
+        NtermType = cappedTerminus;
+        CtermType = cappedTerminus;
         
         for (a=0;a<3;a++)for(b=0;b<100;b++) sequences[a][b] = '.';
         for (a=0;a<3;a++) for(b=0;b<3;b++) for(c=0;c<3;c++) for(d=0;d<9;d++)
@@ -204,13 +608,13 @@ struct TripleHelix
         }
     };
     
-    bool isXaa(short position)
+    bool isXaa(short position) const
     {
         if (abs(position + (3 - this->XaaPos)) % 3 == 0) return true;
         return false;
     };
     
-    bool isYaa(short position)
+    bool isYaa(short position) const
     {
         if (abs(position + (3 - this->XaaPos)) % 3 == 1) return true;
         return false;
@@ -289,6 +693,81 @@ struct TripleHelix
             cout << "This peptide does not appear to have a Gly every third residue!" << endl;
             dissect();
         }
+        encode();
+    };
+    
+    // Flat axial/lateral table indices for one interaction thread between peptide "first" and the peptide that follows it ("second").
+    // Both strands are read starting at firstStart / secondStart, with len residues in common.
+    // The axial partner of each Yaa sits axialShift residues along the second strand and the lateral partner lateralShift residues along.
+    // Entries after the last Yaa through lastPair are -1.
+    void BuildThreadIndex(short first, short firstStart, short second, short secondStart, short len, short axialShift, short lateralShift, short lastPair, short axialIndex[], short lateralIndex[])
+    {
+        short x, i;
+        
+        // YaaList is in full sequence positions but windows start on whole triplets, so the phase is the same.
+        for (i=0; (i<numYaaPos) && (YaaList[i]<len); i++)
+        {
+            x = YaaList[i];
+            if (((x+axialShift) >= 0) && ((x+axialShift) < len)) axialIndex[i] = 27*residue[first][firstStart+x] + residue[second][secondStart+x+axialShift];
+            else axialIndex[i] = -1;
+            if (((x+lateralShift) >= 0) && ((x+lateralShift) < len)) lateralIndex[i] = 27*residue[first][firstStart+x] + residue[second][secondStart+x+lateralShift];
+            else lateralIndex[i] = -1;
+        }
+        for (;i<=lastPair;i++)
+        {
+            axialIndex[i] = -1;
+            lateralIndex[i] = -1;
+        }
+    };
+    
+    // Precomputes the termination, residue indices, Xaa/Yaa/Gly phases, window charges and the canonical interaction threads.
+    void encode(void)
+    {
+        short p, q, x, t, s;
+        
+        if ((Nterm == "n") || (Nterm == "N")) NtermType = chargedTerminus; else NtermType = cappedTerminus;
+        if ((Cterm == "c") || (Cterm == "C")) CtermType = chargedTerminus; else CtermType = cappedTerminus;
+        for (p=0;p<3;p++) peptideID[p] = -1;
+        peptidePool = 0;
+        
+        numYaaPos = 0;
+        for (x=0;x<numAA;x++)
+        {
+            phase[x] = abs(x + (3 - XaaPos)) % 3;
+            if ((phase[x] == 1) && (numYaaPos < 34)) YaaList[numYaaPos++] = x;
+            for (p=0;p<numPep;p++)
+            {
+                residue[p][x] = (unsigned char)((short)sequences[p][x]-64);
+                if (residue[p][x] > 26) residue[p][x] = 0; // not a letter; scored as the undefined amino acid.
+                if (phase[x] == 2) propensityIndex[p][x] = 54;
+                else propensityIndex[p][x] = residue[p][x] + 27*phase[x];
+            }
+        }
+        
+        for (p=0;p<numPep;p++) for (t=0;t<3;t++) for (s=0;s<=t;s++)
+        {
+            windowNetCharge[p][t][s] = 0;
+            windowTotalCharge[p][t][s] = 0;
+            for (x=3*s;x<(3*s + numAA - 3*t);x++)
+            {
+                if ((sequences[p][x] == 'K') || (sequences[p][x] == 'R'))
+                {
+                    windowNetCharge[p][t][s]++;
+                    windowTotalCharge[p][t][s]++;
+                }
+                if ((sequences[p][x] == 'E') || (sequences[p][x] == 'D'))
+                {
+                    windowNetCharge[p][t][s]--;
+                    windowTotalCharge[p][t][s]++;
+                }
+            }
+        }
+        
+        for (p=0;p<numPep;p++) for (q=0;q<numPep;q++)
+        {
+            BuildThreadIndex(p, 0, q, 0, numAA, 2, -1, numAA/3, threadAxialIndex[0][p][q], threadLateralIndex[0][p][q]);
+            BuildThreadIndex(p, 0, q, 0, numAA, 5, 2, numAA/3, threadAxialIndex[1][p][q], threadLateralIndex[1][p][q]);
+        }
     };
         
     void userOutput(void)
@@ -302,7 +781,9 @@ struct TripleHelix
         cout << "Experimental Tm = " << expTm << endl;
         cout << "Deviation (Tm(predicted) - Tm(experimental)) = " <<  CCTm - expTm << endl;
         cout << endl;
-        cout << "The most stable register/composition is {" << bestRegister[0] <<  bestRegister[1]  << bestRegister[2] << "}. Tm = " << HighTm << "." << endl;
+        cout << "The most stable register/composition is {" << bestRegister[0] <<  bestRegister[1]  << bestRegister[2] << "}";
+        if (bestRegister[3] != 0) cout << " with offset " << offsetName[bestRegister[3]];
+        cout << ". Tm = " << HighTm << "." << endl;
         cout << "Total charge on {" << bestRegister[0] <<  bestRegister[1]  << bestRegister[2] << "} = " << totalCharge[bestRegister[0]][bestRegister[1]][bestRegister[2]][bestRegister[3]] << endl;
         cout << "Net charge on {" << bestRegister[0] <<  bestRegister[1]  << bestRegister[2] << "} = " << netCharge[bestRegister[0]][bestRegister[1]][bestRegister[2]][bestRegister[3]] << endl;
         if (numPep == 2)
@@ -358,8 +839,8 @@ struct TripleHelix
         cout << endl;
         
         x = bestRegister[1];
-        if ((bestRegister[3] == 0) || bestRegister[3] == 1) cout << bestRegister[1] << ":  ";
-        if ((bestRegister[3] == 2) || bestRegister[3] == 3) cout << bestRegister[1] << ":     ";
+        cout << bestRegister[1] << ":  ";
+        for (y=0;y<offsetMidShift[bestRegister[3]];y++) cout << " ";
         for (y=0;y<numAA;y++)
         {
             if (sequences[x][y] == 'K') cout << "\x1b[1m\x1b[34m";
@@ -373,8 +854,8 @@ struct TripleHelix
         cout << endl;
         
         x = bestRegister[2];
-        if ((bestRegister[3] == 0) || bestRegister[3] == 2) cout << bestRegister[2] << ":   ";
-        if ((bestRegister[3] == 1) || bestRegister[3] == 3) cout << bestRegister[2] << ":      ";
+        cout << bestRegister[2] << ":   ";
+        for (y=0;y<offsetTrailShift[bestRegister[3]];y++) cout << " ";
         for (y=0;y<numAA;y++)
         {
             if (sequences[x][y] == 'K') cout << "\x1b[1m\x1b[34m";
@@ -390,7 +871,9 @@ struct TripleHelix
         if (numPep != 1)
         {
             cout << endl;
-            cout << "The second most stable register/composition is {" << secRegister[0] << secRegister[1] << secRegister[2] << "}. Tm = " << secTm << "." << endl;
+            cout << "The second most stable register/composition is {" << secRegister[0] << secRegister[1] << secRegister[2] << "}";
+            if (secRegister[3] != 0) cout << " with offset " << offsetName[secRegister[3]];
+            cout << ". Tm = " << secTm << "." << endl;
             x = secRegister[0];
             cout << secRegister[0] << ": ";
             for (y=0;y<numAA;y++)
@@ -406,6 +889,7 @@ struct TripleHelix
             cout << endl;
             x = secRegister[1];
             cout << secRegister[1] << ":  ";
+            for (y=0;y<offsetMidShift[secRegister[3]];y++) cout << " ";
             for (y=0;y<numAA;y++)
             {
                 if (sequences[x][y] == 'K') cout << "\x1b[1m\x1b[34m";
@@ -419,6 +903,7 @@ struct TripleHelix
             cout << endl;
             x = secRegister[2];
             cout << secRegister[2] << ":   ";
+            for (y=0;y<offsetTrailShift[secRegister[3]];y++) cout << " ";
             for (y=0;y<numAA;y++)
             {
                 if (sequences[x][y] == 'K') cout << "\x1b[1m\x1b[34m";
@@ -445,8 +930,8 @@ struct TripleHelix
                 for (c=0;c<numPep;c++)
                 {
                     cout << "\x1b[0m";
-                    if ((a == bestRegister[0]) && (b == bestRegister[1]) && (c == bestRegister[2])) cout << "\x1b[1m\x1b[34m";
-                    if ((a == secRegister[0]) && (b == secRegister[1]) && (c == secRegister[2])) cout << "\x1b[1m\x1b[31m";
+                    if ((a == bestRegister[0]) && (b == bestRegister[1]) && (c == bestRegister[2]) && (bestRegister[3] == 0)) cout << "\x1b[1m\x1b[34m";
+                    if ((a == secRegister[0]) && (b == secRegister[1]) && (c == secRegister[2]) && (secRegister[3] == 0)) cout << "\x1b[1m\x1b[31m";
                     if (Tm[a][b][c][0] < 10) cout << "\x1b[2m";
                     cout << "{" << a << b << c << "} = " << Tm[a][b][c][0] << endl;
                     cout << "\x1b[0m";
@@ -454,21 +939,185 @@ struct TripleHelix
             }
             cout << endl;
         }
+        
+        if (numOffsets == 9)
+        {
+            short d;
+            cout << "Melting temperatures of all compositions/registers at each offset." << endl;
+            for (d=0;d<9;d++) cout << "\t" << offsetName[d];
+            cout << endl;
+            for (a=0;a<numPep;a++) for (b=0;b<numPep;b++) for (c=0;c<numPep;c++)
+            {
+                cout << "{" << a << b << c << "}";
+                for (d=0;d<9;d++)
+                {
+                    cout << "\t";
+                    if ((a == bestRegister[0]) && (b == bestRegister[1]) && (c == bestRegister[2]) && (d == bestRegister[3])) cout << "\x1b[1m\x1b[34m";
+                    if ((a == secRegister[0]) && (b == secRegister[1]) && (c == secRegister[2]) && (d == secRegister[3])) cout << "\x1b[1m\x1b[31m";
+                    if (Tm[a][b][c][d] < 10) cout << "\x1b[2m";
+                    cout << Tm[a][b][c][d];
+                    cout << "\x1b[0m";
+                }
+                cout << endl;
+            }
+            cout << endl;
+        }
+    };
+    
+};
+
+// Every distinct peptide of a library, by its residues, length and phase (XaaPos), numbered in the order it was first
+// seen. The training library repeats many peptides, such as the POG host strands of the "POG variations" and "Yaa Subs"
+// series, and an entry's peptides are known by these numbers (TripleHelix::peptideID) so that the entries with the same
+// peptides can share their scoring (see ScoreEntries). Each library owns its pool and empties it with clear(), so a
+// streamed library or the batches of --mode serve only hold the peptides they are scoring.
+atomic<unsigned long> peptidePoolSerials(0);
+
+struct peptidePoolType
+{
+    mutex                       lock;
+    unordered_map<string, long> numbers;
+    unsigned long               serial = ++peptidePoolSerials;
+    
+    // Sets the peptideID of each peptide of theHelix, which must be ready to score (as after determine_reptition),
+    // unless they are already from this pool.
+    void intern(TripleHelix & theHelix)
+    {
+        short p;
+        
+        if (theHelix.peptidePool == serial) return;
+        lock_guard<mutex> hold(lock);
+        for (p=0;p<theHelix.numPep;p++)
+        {
+            string key((const char *)theHelix.residue[p], theHelix.numAA);
+            key += char(theHelix.XaaPos);
+            auto found = numbers.find(key);
+            if (found != numbers.end()) theHelix.peptideID[p] = found->second;
+            else
+            {
+                theHelix.peptideID[p] = numbers.size();
+                numbers[key] = theHelix.peptideID[p];
+            }
+        }
+        theHelix.peptidePool = serial;
     };
     
+    // A new serial as well, so numbers handed out before are never taken for the new ones.
+    void clear(void)
+    {
+        lock_guard<mutex> hold(lock);
+        numbers.clear();
+        serial = ++peptidePoolSerials;
+    };
 };
+
+// Growable library of helices. Helices are allocated blockSize at a time and a block is never moved, so
+// references to a helix stay valid as the library grows and the library itself has no fixed limit on the number of
+// helices. The training library is numbered with short throughout, so it is read with at most maxTrainingHelices
+// (see readLibrary). User libraries are streamed in chunks (StreamLibrary) and may be of any size.
+// clear() keeps the blocks so a library read again reuses them.
+struct HelixLibrary
+{
+    static const long blockSize = 64;
+    vector< unique_ptr<TripleHelix[]> > blocks;
+    long count = 0;
+    peptidePoolType peptides;
+    
+    TripleHelix & operator[] (long n)
+    {
+        return blocks[n/blockSize][n%blockSize];
+    };
+    
+    long size(void) const
+    {
+        return count;
+    };
+    
+    // Appends an initialized helix.
+    TripleHelix & add(void)
+    {
+        if (count == (long)blocks.size()*blockSize) blocks.push_back(unique_ptr<TripleHelix[]>(new TripleHelix[blockSize]));
+        TripleHelix & newHelix = (*this)[count++];
+        newHelix.initializeAll();
+        return newHelix;
+    };
+    
+    void clear(void)
+    {
+        count = 0;
+        peptides.clear();
+    };
     
-parameterType ReadParameters(void)
+    void removeLast(void)
+    {
+        if (count > 0) count--;
+    };
+};
+
+// Appends value as the records give numbers, with ten significant digits.
+void AppendNumber (string & out, double value)
+{
+    char number[32];
+    snprintf(number, sizeof(number), "%.10g", value);
+    out += number;
+}
+
+// Appends text as a JSON string, quoted and escaped. The terminations come straight from the requests of option (9).
+void AppendJson (string & out, const string & text)
+{
+    char escaped[8];
+    out += '"';
+    for (size_t k=0;k<text.size();k++)
+    {
+        unsigned char c = text[k];
+        if ((c == '"') || (c == '\\')) out += '\\';
+        if (c < 0x20)
+        {
+            snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else out += c;
+    }
+    out += '"';
+}
+
+// Appends text as a csv field, quoted only if it holds a comma, a quote or a line break.
+void AppendCsv (string & out, const string & text)
+{
+    if (text.find_first_of(",\"\r\n") == string::npos)
+    {
+        out += text;
+        return;
+    }
+    out += '"';
+    for (size_t k=0;k<text.size();k++)
+    {
+        if (text[k] == '"') out += '"';
+        out += text[k];
+    }
+    out += '"';
+}
+
+// getline for the text input files, which may have been saved with Windows (CR LF) line endings.
+istream & GetLine (istream & file, string & line)
+{
+    getline(file, line);
+    if ((line.size() > 0) && (line[line.size()-1] == '\r')) line.erase(line.size()-1);
+    return file;
+}
+
+parameterType ReadParameters(string parameterName = "parameters.txt", string experimentalName = "parameters_exp.txt", string optimizationName = "opt_list.txt")
 {
     // Read parameters from file.
+    PROFILE_SPAN(profileReadParameters);
     parameterType parameters;
     short x, y;
     char SingleAminoAcid, parameterChar;
     short optValue;
     string StringLine;
     
-    ifstream parameterFile("parameters.txt");
-    if (!parameterFile.is_open()) cout << "We couldn't open the parameters.txt file." << endl;
+    ifstream parameterFile(parameterName);
+    if (!parameterFile.is_open()) cout << "We couldn't open the " << parameterName << " file." << endl;
     
     // Zero initial values.
     for (x=0;x<27;x++)
@@ -495,12 +1144,16 @@ parameterType ReadParameters(void)
         }
     }
     
-    getline(parameterFile, StringLine);
-    cout << "Parameter File: " << StringLine << endl;
+    GetLine(parameterFile, StringLine);
+    // newParameters.txt (see WriteParameters) has no date line and starts with its first section.
+    bool dated = (StringLine != "Length");
+    if (dated) cout << "Parameter File: " << StringLine << endl;
+    else cout << "Parameter File: " << parameterName << endl;
   
     while (!parameterFile.eof())
     {
-        getline(parameterFile, StringLine);
+        if (dated) GetLine(parameterFile, StringLine);
+        dated = true;
         if (StringLine == "Length")
         {
             //cout << "we found Length" << endl;
@@ -530,7 +1183,7 @@ parameterType ReadParameters(void)
         if (StringLine == "PairwiseLateral")
         {
             //cout << "we found PairwiseLateral" << endl;
-            getline(parameterFile, StringLine);
+            GetLine(parameterFile, StringLine);
             for (y=1; y<27; y++)
             {
                 parameterFile >> parameterChar;
@@ -544,7 +1197,7 @@ parameterType ReadParameters(void)
         if (StringLine == "PairwiseAxial")
         {
             //cout << "we found PairwiseAxial" << endl;
-            getline(parameterFile, StringLine);
+            GetLine(parameterFile, StringLine);
             for (y=1; y<27; y++)
             {
                 parameterFile >> parameterChar;
@@ -561,15 +1214,15 @@ parameterType ReadParameters(void)
     }
     parameterFile.close();
     
-    parameterFile.open("parameters_exp.txt");
-    if (!parameterFile.is_open()) cout << "We couldn't open the parameters.txt file." << endl;
+    parameterFile.open(experimentalName);
+    if (!parameterFile.is_open()) cout << "We couldn't open the " << experimentalName << " file." << endl;
       
-    getline(parameterFile, StringLine);
+    GetLine(parameterFile, StringLine);
     cout << "Experimental Parameter File: " << StringLine << endl;
     
     while (!parameterFile.eof())
       {
-          getline(parameterFile, StringLine);
+          GetLine(parameterFile, StringLine);
           if (StringLine == "Length")
           {
               //cout << "we found Length" << endl;
@@ -599,7 +1252,7 @@ parameterType ReadParameters(void)
           if (StringLine == "PairwiseLateral")
           {
               //cout << "we found PairwiseLateral" << endl;
-              getline(parameterFile, StringLine);
+              GetLine(parameterFile, StringLine);
               for (y=1; y<27; y++)
               {
                   parameterFile >> parameterChar;
@@ -613,7 +1266,7 @@ parameterType ReadParameters(void)
           if (StringLine == "PairwiseAxial")
           {
               //cout << "we found PairwiseAxial" << endl;
-              getline(parameterFile, StringLine);
+              GetLine(parameterFile, StringLine);
               for (y=1; y<27; y++)
               {
                   parameterFile >> parameterChar;
@@ -632,16 +1285,16 @@ parameterType ReadParameters(void)
     
     // Optionally read in which values will be optimized.
     
-    parameterFile.open("opt_list.txt");
+    parameterFile.open(optimizationName);
     
-    getline(parameterFile, StringLine);
+    GetLine(parameterFile, StringLine);
     cout << "Optimization List: " << StringLine << endl;
     
-    if (!parameterFile.is_open()) cout << "We couldn't open the parameters.txt file." << endl;
+    if (!parameterFile.is_open()) cout << "We couldn't open the " << optimizationName << " file." << endl;
     
     while (!parameterFile.eof())
     {
-        getline(parameterFile, StringLine);
+        GetLine(parameterFile, StringLine);
         if (StringLine == "Length")
         {
             //cout << "we found Length" << endl;
@@ -674,7 +1327,7 @@ parameterType ReadParameters(void)
         if (StringLine == "PairwiseLateral")
         {
             //cout << "we found PairwiseLateral" << endl;
-            getline(parameterFile, StringLine);
+            GetLine(parameterFile, StringLine);
             for (y=1; y<27; y++)
             {
                 parameterFile >> parameterChar;
@@ -689,7 +1342,7 @@ parameterType ReadParameters(void)
         if (StringLine == "PairwiseAxial")
         {
             //cout << "we found PairwiseAxial" << endl;
-            getline(parameterFile, StringLine);
+            GetLine(parameterFile, StringLine);
             for (y=1; y<27; y++)
             {
                 parameterFile >> parameterChar;
@@ -708,10 +1361,11 @@ parameterType ReadParameters(void)
     parameterFile.close();
     
     
+    parameters.version = NextParameterVersion();
     return parameters;
 }
 
-void DisplayParameters(parameterType parameters)
+void DisplayParameters(const parameterType & parameters)
 {
     short x, y;
   
@@ -821,7 +1475,7 @@ void DisplayParameters(parameterType parameters)
     cout << endl;
 }
 
-void WriteParameters(parameterType parameters)
+void WriteParameters(const scoringParameters & parameters)
 {
     // Write parameters to file.
     ofstream newParameters("newParameters.txt");
@@ -868,604 +1522,4561 @@ void WriteParameters(parameterType parameters)
 }
 
 
-// Will be better to pass a pointer to parameters rather than the entire struct, but this works for now.
-
-void ScoreHelix (parameterType parameters, TripleHelix * theHelix)
+// Fills the axial and lateral values of one interaction thread, entries 0 through lastPair, from its flat table indices.
+void FillInteractionThread (const scoringParameters & parameters, const short axialIndex[], const short lateralIndex[], short lastPair, double XPW[], double LPW[])
 {
-    short a, b, c, d, x, y, i;
-        
-    for (a=0;a<3;a++)for(b=0;b<3;b++)for(c=0;c<3;c++)for(d=0;d<9;d++)
+    const double * axialTable = &parameters.axial[0][0];
+    const double * lateralTable = &parameters.lateral[0][0];
+    short i;
+    
+    for (i=0;i<=lastPair;i++)
     {
-        theHelix->Propensity[a][b][c][d] = 0;
-        theHelix->PairWise[a][b][c][d] = 0;
-        theHelix->Tm[a][b][c][d] = 0;
+        if (axialIndex[i] >= 0) XPW[i] = axialTable[axialIndex[i]]; else XPW[i] = 0;
+        if (lateralIndex[i] >= 0) LPW[i] = lateralTable[lateralIndex[i]]; else LPW[i] = 0;
     }
+}
+
+// Propensity of one window of a peptide, len residues from propensityIndex[0], with the three first and two last residues counted at 1/3.
+// weight[] holds propensityX, then propensityY, then a zero for Gly.
+// Compiled with AVX2 the middle of the window is gathered four residues at a time. The gathered values are still added one
+// after another, in the order of the scalar loop, so the sum (and with it every tie between registers) doesn't depend on the build.
+double WindowPropensity (const double weight[], const int propensityIndex[], short len)
+{
+    double sum = 0;
+    short x = 0;
+    
+    for (;(x<3) && (x<len);x++) sum += weight[propensityIndex[x]]/3; // the tips
     
-    double XinteractionThread[20];
-    double LinteractionThread[20];
-    for (x=0; x<20; x++)
+#ifdef __AVX2__
+    const __m256d allLanes = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    double lanes[4];
+    for (;(x+3)<(len-2);x+=4)
     {
-        XinteractionThread[x] = 0;
-        LinteractionThread[x] = 0;
+        __m128i index = _mm_loadu_si128((const __m128i *)&propensityIndex[x]);
+        _mm256_storeu_pd(lanes, _mm256_mask_i32gather_pd(_mm256_setzero_pd(), weight, index, allLanes, 8));
+        sum += lanes[0];
+        sum += lanes[1];
+        sum += lanes[2];
+        sum += lanes[3];
     }
+#endif
+    for (;x<(len-2);x++) sum += weight[propensityIndex[x]];
     
-    // this triple helix will hold the temporary values for all trimmed non-canonical offsets.
-    TripleHelix trimmedHelix;
-    
-    short numYaa = 0;
-    numYaa = theHelix->numAA / 3;
+    for (;x<len;x++) sum += weight[propensityIndex[x]]/3; // the tips
+    return sum;
+}
+
+// Linearized Tm. For a fixed register and fixed pairwise choices the Tm is linear in propensityX, propensityY, axial and lateral.
+// A feature is one of those values, numbered as below, and its weight is how many times (fractions at the window tips)
+// the register's Tm counts it: Tm = constant + the sum of weight * value over its features.
+const short featurePropensityX = 0;     // + residue
+const short featurePropensityY = 27;    // + residue
+const short featureAxial = 54;          // + 27*Yaa + partner
+const short featureLateral = 54 + 729;  // + 27*Yaa + partner
+const short featureCount = 54 + 2*729;
+
+struct featureEntry
+{
+    short   feature;
+    double  weight;
+};
+
+double & FeatureValue (scoringParameters & parameters, short feature)
+{
+    if (feature < featurePropensityY) return parameters.propensityX[feature - featurePropensityX];
+    if (feature < featureAxial) return parameters.propensityY[feature - featurePropensityY];
+    if (feature < featureLateral) return (&parameters.axial[0][0])[feature - featureAxial];
+    return (&parameters.lateral[0][0])[feature - featureLateral];
+}
+
+double ExperimentalValue (const parameterType & parameters, short feature)
+{
+    if (feature < featurePropensityY) return parameters.exPropensityX[feature - featurePropensityX];
+    if (feature < featureAxial) return parameters.exPropensityY[feature - featurePropensityY];
+    if (feature < featureLateral) return (&parameters.exAxial[0][0])[feature - featureAxial];
+    return (&parameters.exLateral[0][0])[feature - featureLateral];
+}
+
+bool FeatureOptimized (const parameterType & parameters, short feature)
+{
+    if (feature < featurePropensityY) return parameters.optPropX[feature - featurePropensityX];
+    if (feature < featureAxial) return parameters.optPropY[feature - featurePropensityY];
+    if (feature < featureLateral) return (&parameters.optAxial[0][0])[feature - featureAxial];
+    return (&parameters.optLat[0][0])[feature - featureLateral];
+}
+
+// Sorts features by number and adds up the weights of repeated ones.
+void MergeFeatures (vector<featureEntry> & features)
+{
+    size_t k, kept = 0;
     
-    double maxTm, secondBestTm;
-    double bestReg[4], secondBestReg[4];
-    double lengthBasis = 0;
-    secondBestTm = -2000;
-    secondBestReg[0] = 5;
-    secondBestReg[1] = 5;
-    secondBestReg[2] = 5;
-    secondBestReg[3] = 10;
+    sort(features.begin(), features.end(), [] (const featureEntry & first, const featureEntry & second) { return first.feature < second.feature; });
+    for (k=0;k<features.size();k++)
+    {
+        if ((kept > 0) && (features[kept-1].feature == features[k].feature)) features[kept-1].weight += features[k].weight;
+        else features[kept++] = features[k];
+    }
+    features.resize(kept);
+}
+
+// The features of one window of a peptide as WindowPropensity sums it: the three first and two last residues at 1/3. Gly has none.
+void AddWindowFeatures (const int propensityIndex[], short len, vector<featureEntry> & features)
+{
+    short x;
     
-    maxTm = -1000;
-    bestReg[0] = 6;
+    for (x=0;x<len;x++)
+    {
+        if (propensityIndex[x] == 54) continue;
+        if ((x < 3) || (x >= (len-2))) features.push_back({(short)propensityIndex[x], 1.0/3});
+        else features.push_back({(short)propensityIndex[x], 1});
+    }
+}
+
+// The features of one interaction thread: the stabilizing interactions PairWiseCalc chose and every destabilizing one.
+// Entries that are exactly zero are counted with the destabilizing ones, since lowering them would make them count.
+void AddThreadFeatures (const double XPW[], const double LPW[], const short axialIndex[], const short lateralIndex[], short lastPair, vector<featureEntry> & features)
+{
+    short used[20];
+    short x;
+    
+    PairWiseChoice(XPW, LPW, lastPair, used);
+    for (x=0;x<=lastPair;x++)
+    {
+        if (axialIndex[x] >= 0)
+        {
+            if (((used[x] & 2) && (XPW[x] > 0)) || ((x < lastPair) && (XPW[x] <= 0))) features.push_back({(short)(featureAxial + axialIndex[x]), 1});
+        }
+        if (lateralIndex[x] >= 0)
+        {
+            if (((used[x] & 1) && (LPW[x] > 0)) || ((x < lastPair) && (LPW[x] <= 0))) features.push_back({(short)(featureLateral + lateralIndex[x]), 1});
+        }
+    }
+}
+
+// The propensity of every window of every peptide of theHelix, windowPropensity[peptide][t][s] (see ScoreHelix).
+// Only the untrimmed windows (t = 0) are summed unless allOffsets is true.
+void WindowPropensities (const scoringParameters & parameters, const TripleHelix * theHelix, bool allOffsets, double windowPropensity[3][3][3])
+{
+    double propensityWeight[55];
+    short x, p, t, s;
+    
+    PROFILE_SPAN(profileWindows);
+    for (x=0;x<27;x++)
+    {
+        propensityWeight[x] = parameters.propensityX[x];
+        propensityWeight[27+x] = parameters.propensityY[x];
+    }
+    propensityWeight[54] = 0;
+    
+    for (p=0;p<theHelix->numPep;p++) for (t=0;t<3;t++) for (s=0;s<=t;s++)
+    {
+        windowPropensity[p][t][s] = 0;
+        if ((t > 0) && (not allOffsets)) continue;
+        windowPropensity[p][t][s] = WindowPropensity(propensityWeight, &theHelix->propensityIndex[p][3*s], theHelix->numAA - 3*t);
+    }
+}
+
+// The scores of one composition / register, as stored in the Propensity, PairWise, Tm and charge tables of its helix.
+struct registerScore
+{
+    double  Propensity, PairWise, Tm;
+    short   netCharge, totalCharge;
+};
+
+// Remembered scores of registers and of the stabilizing part of interaction threads, shared by every helix scored while
+// enabled (the interactive helix and option (2)). A register is keyed by the residues of its three peptides, the phase,
+// the termination and the offset, and a thread by its axial and lateral table indices, so the same peptides in another
+// helix, or an edit that is later undone, are not scored again. Entries are only good for the parameters they were
+// scored with; when parameters with another version are scored everything is forgotten first.
+// Safe to use from the scoring threads. Full tables are emptied rather than trimmed.
+struct scoreCacheType
+{
+    bool            enabled = false;
+    size_t          maxEntries = 100000;
+    unsigned long   version = 0;
+    mutex           lock;
+    unordered_map<string, registerScore>    registers;
+    unordered_map<string, double>           threads;
+    long            registerHits = 0, registerMisses = 0, threadHits = 0, threadMisses = 0;
+    
+    // Forgets everything if the entries were scored with other parameters. Call with lock held.
+    void checkVersion(const scoringParameters & parameters)
+    {
+        if (version == parameters.version) return;
+        registers.clear();
+        threads.clear();
+        version = parameters.version;
+    }
+    
+    // With propensityKnown the propensity was copied from the sorted permutation (see ScoreHelix) rather than summed in this
+    // order, which can differ in the last bits, so the two are kept apart.
+    string registerKey(const TripleHelix * theHelix, short a, short b, short c, short d, bool propensityKnown)
+    {
+        string key;
+        key.reserve(3*theHelix->numAA + 5);
+        key.append((const char *)theHelix->residue[a], theHelix->numAA);
+        key.append((const char *)theHelix->residue[b], theHelix->numAA);
+        key.append((const char *)theHelix->residue[c], theHelix->numAA);
+        key += char(theHelix->XaaPos);
+        key += char(theHelix->NtermType);
+        key += char(theHelix->CtermType);
+        key += char(d);
+        key += char(propensityKnown);
+        return key;
+    }
+    
+    bool findRegister(const scoringParameters & parameters, const string & key, registerScore & score)
+    {
+        lock_guard<mutex> hold(lock);
+        checkVersion(parameters);
+        auto found = registers.find(key);
+        if (found == registers.end())
+        {
+            registerMisses++;
+            return false;
+        }
+        registerHits++;
+        score = found->second;
+        return true;
+    }
+    
+    void addRegister(const scoringParameters & parameters, const string & key, const registerScore & score)
+    {
+        lock_guard<mutex> hold(lock);
+        checkVersion(parameters);
+        if (registers.size() >= maxEntries) registers.clear();
+        registers[key] = score;
+    }
+    
+    // PairWiseCalc of the thread with these table indices, entries 0 through lastPair, whose values are in XPW and LPW.
+    double pairWise(const scoringParameters & parameters, const short axialIndex[], const short lateralIndex[], double XPW[], double LPW[], short lastPair)
+    {
+        string key((const char *)axialIndex, (lastPair+1)*sizeof(short));
+        key.append((const char *)lateralIndex, (lastPair+1)*sizeof(short));
+        {
+            lock_guard<mutex> hold(lock);
+            checkVersion(parameters);
+            auto found = threads.find(key);
+            if (found != threads.end())
+            {
+                threadHits++;
+                return found->second;
+            }
+            threadMisses++;
+        }
+        
+        double value = PairWiseCalc(XPW, LPW, lastPair);
+        lock_guard<mutex> hold(lock);
+        checkVersion(parameters);
+        if (threads.size() >= maxEntries) threads.clear();
+        threads[key] = value;
+        return value;
+    }
+    
+    void report(void)
+    {
+        lock_guard<mutex> hold(lock);
+        cout << "Score cache: " << registerHits << " of " << registerHits + registerMisses << " registers and ";
+        cout << threadHits << " of " << threadHits + threadMisses << " interaction threads were already scored." << endl;
+    }
+};
+scoreCacheType scoreCache;
+
+// The stabilizing part of one interaction thread, from PairWiseCalc or, when it is enabled, scoreCache.
+double ThreadPairWise (const scoringParameters & parameters, const short axialIndex[], const short lateralIndex[], double XPW[], double LPW[], short lastPair)
+{
+    if (scoreCache.enabled) return scoreCache.pairWise(parameters, axialIndex, lateralIndex, XPW, LPW, lastPair);
+    return PairWiseCalc(XPW, LPW, lastPair);
+}
+
+// The scores of the homotrimer of one peptide for each offset, as in the Tm[p][p][p][d] etc. tables of its helix.
+struct homotrimerScore
+{
+    double  Tm[9], Propensity[9], PairWise[9];
+    short   netCharge[9], totalCharge[9];
+};
+
+// One interaction thread: its entries (XPW and LPW, 0 through lastPair), the most it can add to a register's PairWise
+// (bound, see FillPairThread) and, once solved, its stabilizing maximum (PairWiseCalc).
+struct pairThread
+{
+    bool    filled;     // the entries and bound are set
+    bool    known;      // stabilizing is set too
+    short   lastPair;
+    double  bound;
+    double  stabilizing;
+    double  XPW[20], LPW[20];
+};
+
+// Fills one interaction thread from the axial and lateral tables and sets its bound. PairWiseCalc only chooses among the
+// stabilizing entries and the destabilizing ones before lastPair are always added, so no register gets more from the
+// thread than all its entries before lastPair plus the last lateral one if that is stabilizing.
+void FillPairThread (const scoringParameters & parameters, const short axialIndex[], const short lateralIndex[], short lastPair, pairThread & thread)
+{
+    short x;
+    
+    FillInteractionThread(parameters, axialIndex, lateralIndex, lastPair, thread.XPW, thread.LPW);
+    thread.lastPair = lastPair;
+    thread.bound = 0;
+    for (x=0;x<lastPair;x++) thread.bound += thread.XPW[x] + thread.LPW[x];
+    if (thread.LPW[lastPair] > 0) thread.bound += thread.LPW[lastPair];
+    thread.filled = true;
+}
+
+// Fills one interaction thread, if it isn't yet, and solves it.
+void SolvePairThread (const scoringParameters & parameters, const short axialIndex[], const short lateralIndex[], short lastPair, pairThread & thread)
+{
+    PROFILE_COUNT(profilePairThread, lastPair + 1);
+    if (not thread.filled) FillPairThread(parameters, axialIndex, lateralIndex, lastPair, thread);
+    
+    // find best combination of stabilizing interactions
+    thread.stabilizing = ThreadPairWise(parameters, axialIndex, lateralIndex, thread.XPW, thread.LPW, lastPair);
+    thread.known = true;
+}
+
+// Adds a solved thread to a register's pairWise, which it starts if first: the stabilizing maximum, then *ALL* possible
+// destabilizing interactions are forced, axial before lateral at each Yaa.
+void AddThreadPairWise (const pairThread & thread, bool first, double & pairWise)
+{
+    short x;
+    
+    if (first) pairWise = thread.stabilizing;
+    else pairWise += thread.stabilizing;
+    for (x=0;x<thread.lastPair;x++)
+    {
+        if (thread.XPW[x] < 0) pairWise += thread.XPW[x];
+        if (thread.LPW[x] < 0) pairWise += thread.LPW[x];
+    }
+}
+
+// Interaction threads solved ahead of a helix's scoring, in the layout of pairThreadTable::threads, by ScoreEntries for
+// the pairs of peptides several entries have. The threads that are NULL are solved by the helix's own scoring.
+typedef pairThread * sharedThreadTable[9][3][3][3];
+
+// The interaction threads of one helix under one set of parameters, each solved the first time a register needs it.
+// The first thread of a register runs from its leading to its middle strand, the second from the middle to the trailing
+// and the third from the trailing back to the leading strand. A thread only depends on the two peptides it joins, on
+// where it is in the register and on the offset, so the 27 registers of an ABC helix share 9 of each. On the
+// canonical offset the first two are the same kind of thread over whole peptides and share their entries too.
+struct pairThreadTable
+{
+    pairThread  threads[9][3][3][3];   // [offset][thread][first peptide][second peptide]
+    sharedThreadTable * shared = NULL;  // used in place of threads where it has them
+    
+    void reset (short numOffsets, short numPep = 3)
+    {
+        short d, k, p, q;
+        for (d=0;d<numOffsets;d++) for (k=0;k<3;k++) for (p=0;p<numPep;p++) for (q=0;q<numPep;q++)
+        {
+            threads[d][k][p][q].filled = false;
+            threads[d][k][p][q].known = false;
+        }
+    };
+    
+    pairThread & entry (short d, short k, short first, short second)
+    {
+        if ((d == 0) && (k == 1)) k = 0;
+        if ((shared != NULL) && ((*shared)[d][k][first][second] != NULL)) return *(*shared)[d][k][first][second];
+        return threads[d][k][first][second];
+    };
+};
+
+// The table indices of thread x (0-2, see pairThreadTable) of register a, b, c, d of theHelix: the canonical threads
+// were indexed by theHelix->encode(), staggered strands are indexed here into axialIndex and lateralIndex.
+// Returns the thread's lastPair, the number of Yaa positions the register has.
+short RegisterThreadIndex (TripleHelix * theHelix, short a, short b, short c, short d, short x, short axialIndex[], short lateralIndex[], const short * & threadAxial, const short * & threadLateral)
+{
+    // Rather than copying trimmed strands, each strand is read from its own start within theHelix->sequences.
+    short maxShift = offsetMidShift[d];
+    if (offsetTrailShift[d] > maxShift) maxShift = offsetTrailShift[d];
+    short trimmedNumAA = theHelix->numAA - maxShift;
+    short numYaa = trimmedNumAA / 3;
+    const short strand[4] = {a, b, c, a};
+    const short strandStart[4] = {maxShift, (short)(maxShift - offsetMidShift[d]), (short)(maxShift - offsetTrailShift[d]), maxShift};
+    const short axialShift[3] = {2, 2, 5};
+    const short lateralShift[3] = {-1, -1, 2};
+    
+    threadAxial = theHelix->threadAxialIndex[x/2][strand[x]][strand[x+1]];
+    threadLateral = theHelix->threadLateralIndex[x/2][strand[x]][strand[x+1]];
+    if (d != 0)
+    {
+        theHelix->BuildThreadIndex(strand[x], strandStart[x], strand[x+1], strandStart[x+1], trimmedNumAA, axialShift[x], lateralShift[x], numYaa, axialIndex, lateralIndex);
+        threadAxial = axialIndex;
+        threadLateral = lateralIndex;
+    }
+    return numYaa;
+}
+
+// Sets the Propensity and charges of one composition / register of theHelix: the length, termination, Tyr/Trp ends,
+// terminal hydrogen bonds, the windows of its three strands (windowPropensity, see ScoreHelix) and the charge penalty.
+// If features is given the register's propensity features are added to it.
+void RegisterPropensity (const scoringParameters & parameters, TripleHelix * theHelix, const double windowPropensity[3][3][3], short a, short b, short c, short d, vector<featureEntry> * features)
+{
+    double lengthBasis = 0;
+    
+    PROFILE_COUNT(profileRegisterPropensity, 1);
+    short maxShift = offsetMidShift[d];
+    if (offsetTrailShift[d] > maxShift) maxShift = offsetTrailShift[d];
+    short leadStart = maxShift;
+    short midStart = maxShift - offsetMidShift[d];
+    short trailStart = maxShift - offsetTrailShift[d];
+    short trimmedNumAA = theHelix->numAA - maxShift;
+    short t = maxShift / 3;
+    
+    // // // // //
+    // Length   //
+    // // // // //
+    // The lost triplets still contribute part of a triplet each to the effective length.
+    if (trimmedNumAA >50)
+    {
+        lengthBasis = parameters.A + (parameters.B*50) + (parameters.C*50*50);
+    }
+    else
+    {
+        lengthBasis = parameters.A + (parameters.B*(trimmedNumAA+t)) + (parameters.C*(trimmedNumAA+t)*(trimmedNumAA+t));
+    }
+    //cout << "lengthBasis = " << lengthBasis << endl;
+    theHelix->Propensity[a][b][c][d] = lengthBasis;
+    
+    // // // // // //
+    // TERMINATION //
+    // // // // // //
+    if (theHelix->NtermType == chargedTerminus) theHelix->Propensity[a][b][c][d] -= 1.8;
+    if (theHelix->CtermType == chargedTerminus) theHelix->Propensity[a][b][c][d] -= 1.8;
+    
+    // // // // // // // // //
+    // Tyrosine/Tryptophan Termination //
+    // // // // // // // // //
+    char leadFirst = theHelix->sequences[a][leadStart];
+    char midFirst = theHelix->sequences[b][midStart];
+    char trailFirst = theHelix->sequences[c][trailStart];
+    char leadLast = theHelix->sequences[a][leadStart+trimmedNumAA-1];
+    char midLast = theHelix->sequences[b][midStart+trimmedNumAA-1];
+    char trailLast = theHelix->sequences[c][trailStart+trimmedNumAA-1];
+    if ((leadFirst == 'Y') && (midFirst == 'Y') && (trailFirst == 'Y'))
+    {
+        theHelix->Propensity[a][b][c][d] += 3;
+    }
+    if ((leadLast == 'Y') && (midLast == 'Y') && (trailLast == 'Y'))
+    {
+        theHelix->Propensity[a][b][c][d] += 3;
+    }
+    if ((leadFirst == 'W') && (midFirst == 'W') && (trailFirst == 'W'))
+    {
+        theHelix->Propensity[a][b][c][d] += 3;
+    }
+    if ((leadLast == 'W') && (midLast == 'W') && (trailLast == 'W'))
+    {
+        theHelix->Propensity[a][b][c][d] += 3;
+    }
+    
+    //cout << "capping mod = " << Propensity[a][b][c] << endl;
+    
+    // // // // // // // // // // //
+    // Terminal Hydrogen Bonding  //
+    // // // // // // // // // // //
+    // if (not theHelix->isXYG) Propensity[a][b][c][d] -= 3.6;
+    if (theHelix->phase[0] != 0) theHelix->Propensity[a][b][c][d] -= 1.8;
+    if (theHelix->phase[theHelix->numAA-1] != 2) theHelix->Propensity[a][b][c][d] -= 1.8;
+    
+    //cout << "terminal H-bond mod = " << Propensity[a][b][c] << endl;
+    
+    // // // // // // // //
+    // Single AA Score   //
+    // // // // // // // //
+    theHelix->Propensity[a][b][c][d] += windowPropensity[a][t][leadStart/3];
+    theHelix->Propensity[a][b][c][d] += windowPropensity[b][t][midStart/3];
+    theHelix->Propensity[a][b][c][d] += windowPropensity[c][t][trailStart/3];
+    theHelix->netCharge[a][b][c][d] = theHelix->windowNetCharge[a][t][leadStart/3] + theHelix->windowNetCharge[b][t][midStart/3] + theHelix->windowNetCharge[c][t][trailStart/3];
+    theHelix->totalCharge[a][b][c][d] = theHelix->windowTotalCharge[a][t][leadStart/3] + theHelix->windowTotalCharge[b][t][midStart/3] + theHelix->windowTotalCharge[c][t][trailStart/3];
+    if (features != NULL)
+    {
+        AddWindowFeatures(&theHelix->propensityIndex[a][leadStart], trimmedNumAA, *features);
+        AddWindowFeatures(&theHelix->propensityIndex[b][midStart], trimmedNumAA, *features);
+        AddWindowFeatures(&theHelix->propensityIndex[c][trailStart], trimmedNumAA, *features);
+    }
+    
+    // Charge Scoring
+    if (abs(theHelix->netCharge[a][b][c][d]) > 6)
+    {
+        theHelix->Propensity[a][b][c][d] -= ((abs(theHelix->netCharge[a][b][c][d]) - 6)/3);
+    }
+}
+
+// Scores one composition / register (peptides a, b, c with offset d) of theHelix into its Propensity, PairWise, Tm and charge tables.
+// windowPropensity holds the propensity of each window of each peptide, see ScoreHelix.
+// With propensityKnown the Propensity and charges of this register were already set and only the pairwise threads are scored.
+// If features is given the register's features are added to it (see RegisterFeatures).
+// If pairThreads is given the threads are taken from it, and solved into it the first time (see pairThreadTable).
+// It has to have been reset for theHelix and parameters, and is not used together with features.
+void ScoreRegister (const scoringParameters & parameters, TripleHelix * theHelix, const double windowPropensity[3][3][3], short a, short b, short c, short d, bool propensityKnown, vector<featureEntry> * features = NULL, pairThreadTable * pairThreads = NULL)
+{
+    short  axialIndex[20];  // thread indices of a non-canonical offset
+    short  lateralIndex[20];
+    short  x;
+    string cacheKey;
+    registerScore cached;
+    
+    // The same peptides may already have been scored in this register (see scoreCache).
+    if (scoreCache.enabled && (features == NULL))
+    {
+        cacheKey = scoreCache.registerKey(theHelix, a, b, c, d, propensityKnown);
+        if (scoreCache.findRegister(parameters, cacheKey, cached))
+        {
+            theHelix->Propensity[a][b][c][d] = cached.Propensity;
+            theHelix->PairWise[a][b][c][d] = cached.PairWise;
+            theHelix->Tm[a][b][c][d] = cached.Tm;
+            theHelix->netCharge[a][b][c][d] = cached.netCharge;
+            theHelix->totalCharge[a][b][c][d] = cached.totalCharge;
+            return;
+        }
+    }
+    
+    if (not propensityKnown) RegisterPropensity(parameters, theHelix, windowPropensity, a, b, c, d, features);
+    
+    // // // // // // // //
+    // set pairwise Tm   //
+    // // // // // // // //
+    
+    // Each thread runs from one strand to the next. Its stabilizing choices are the best combination of stabilizing
+    // interactions, and *ALL* possible destabilizing interactions are forced (see AddThreadPairWise).
+    const short strand[4] = {a, b, c, a};
+    pairThread solved;
+    solved.filled = false;
+    solved.known = false;
+    for (x=0;x<3;x++)
+    {
+        pairThread * thread = &solved;
+        if (pairThreads != NULL) thread = &pairThreads->entry(d, x, strand[x], strand[x+1]);
+        if (not thread->known)
+        {
+            const short * threadAxial, * threadLateral;
+            short numYaa = RegisterThreadIndex(theHelix, a, b, c, d, x, axialIndex, lateralIndex, threadAxial, threadLateral);
+            SolvePairThread(parameters, threadAxial, threadLateral, numYaa, *thread);
+            if (features != NULL) AddThreadFeatures(thread->XPW, thread->LPW, threadAxial, threadLateral, numYaa, *features);
+        }
+        
+        AddThreadPairWise(*thread, (x == 0), theHelix->PairWise[a][b][c][d]);
+        if (pairThreads == NULL) solved.filled = solved.known = false;
+    }
+    
+    //cout << "Pairwise Mod = " << PairWise[a][b][c] << endl;
+    
+    // Calculate the Tm for this composition / register determined.
+    theHelix->Tm[a][b][c][d] = theHelix->Propensity[a][b][c][d] + theHelix->PairWise[a][b][c][d];
+    
+    if (cacheKey.size() > 0)
+    {
+        cached = {theHelix->Propensity[a][b][c][d], theHelix->PairWise[a][b][c][d], theHelix->Tm[a][b][c][d], theHelix->netCharge[a][b][c][d], theHelix->totalCharge[a][b][c][d]};
+        scoreCache.addRegister(parameters, cacheKey, cached);
+    }
+}
+
+// The register loops of ScoreRegisters and RankRegisters are compiled once for each number of peptides (1-3) and of
+// offsets (1 or 9) so their bounds are constants: a homotrimer is a single iteration, and the composition checks for
+// CCTm are decided when compiling. The registers are still gone through in the same order, so nothing else changes.
+// ScoreRegisters and RankRegisters pick the kernel for theHelix->numPep and theHelix->numOffsets.
+
+// Scores the compositions / registers of theHelix into its tables, with windowPropensity as set up by ScoreHelix.
+// If peptide is not -1 only the registers that include that peptide are scored, and the rest are left as they were.
+// known and shared are as for ScoreHelix.
+template <short numPep, short numOffsets>
+void ScoreRegisterKernel (const scoringParameters & parameters, TripleHelix * theHelix, const double windowPropensity[3][3][3], const homotrimerScore * const * known, sharedThreadTable * shared, short peptide)
+{
+    short a, b, c, d;
+    pairThreadTable pairThreads;
+    
+    pairThreads.reset(numOffsets, numPep);
+    pairThreads.shared = shared;
+    for (a=0; a<numPep; a++) for (b=0; b<numPep; b++) for (c=0; c<numPep; c++) for (d=0;d<numOffsets;d++)
+    {
+        if ((peptide >= 0) && (a != peptide) && (b != peptide) && (c != peptide)) continue;
+        
+        if ((known != NULL) && (known[a] != NULL) && (a == b) && (b == c))
+        {
+            // This homotrimer was scored for another entry of the library with the same peptide.
+            theHelix->Propensity[a][b][c][d] = known[a]->Propensity[d];
+            theHelix->PairWise[a][b][c][d] = known[a]->PairWise[d];
+            theHelix->Tm[a][b][c][d] = known[a]->Tm[d];
+            theHelix->netCharge[a][b][c][d] = known[a]->netCharge[d];
+            theHelix->totalCharge[a][b][c][d] = known[a]->totalCharge[d];
+        }
+        else if ((d == 0) && ((a > b) || (b > c)))
+        {
+            // In the canonical offset every strand keeps its whole peptide, so the propensity and charge of a register
+            // only depend on its composition. They were set with the sorted permutation, which comes first.
+            short low = a, mid = b, high = c;
+            if (low > mid) swap(low, mid);
+            if (mid > high) swap(mid, high);
+            if (low > mid) swap(low, mid);
+            theHelix->Propensity[a][b][c][d] = theHelix->Propensity[low][mid][high][d];
+            theHelix->netCharge[a][b][c][d] = theHelix->netCharge[low][mid][high][d];
+            theHelix->totalCharge[a][b][c][d] = theHelix->totalCharge[low][mid][high][d];
+            ScoreRegister(parameters, theHelix, windowPropensity, a, b, c, d, true, NULL, &pairThreads);
+        }
+        else ScoreRegister(parameters, theHelix, windowPropensity, a, b, c, d, false, NULL, &pairThreads);
+        
+        //cout << "Tm = " << Tm[a][b][c] << " = " << Propensity[a][b][c] << " + " << PairWise[a][b][c] << endl;
+    }
+}
+
+void ScoreRegisters (const scoringParameters & parameters, TripleHelix * theHelix, const double windowPropensity[3][3][3], const homotrimerScore * const * known, sharedThreadTable * shared, short peptide)
+{
+    PROFILE_SPAN(profileScoreRegisters);
+    if (theHelix->numOffsets == 9)
+    {
+        if (theHelix->numPep == 1) ScoreRegisterKernel<1, 9>(parameters, theHelix, windowPropensity, known, shared, peptide);
+        else if (theHelix->numPep == 2) ScoreRegisterKernel<2, 9>(parameters, theHelix, windowPropensity, known, shared, peptide);
+        else ScoreRegisterKernel<3, 9>(parameters, theHelix, windowPropensity, known, shared, peptide);
+    }
+    else
+    {
+        if (theHelix->numPep == 1) ScoreRegisterKernel<1, 1>(parameters, theHelix, windowPropensity, known, shared, peptide);
+        else if (theHelix->numPep == 2) ScoreRegisterKernel<2, 1>(parameters, theHelix, windowPropensity, known, shared, peptide);
+        else ScoreRegisterKernel<3, 1>(parameters, theHelix, windowPropensity, known, shared, peptide);
+    }
+}
+
+// Set to true (see main) to have ScoreHelix only score the registers that could be the best, second best or correct one,
+// for callers that report nothing else. Set before the scoring threads run.
+bool topTwoScoring = false;
+
+// ScoreRegisterKernel for topTwoScoring, without a peptide. Every register's propensity and charges are set and its Tm
+// is bounded by the propensity plus the bounds of its three threads (see FillPairThread). The registers with the highest
+// bounds are scored first and then the rest. Once a register's bound is below the second best Tm so far, and below the
+// best correct Tm so far unless it isn't a correct composition, it can't become any of the three and isn't solved: its Tm is left at the
+// bound, which RankRegisters passes over the same way, and theHelix->fullTable is cleared. Homotrimers are always
+// scored, as ScoreLibrary shares them (known). These registers bypass the register part of scoreCache.
+template <short numPep, short numOffsets>
+void RankedRegisterKernel (const scoringParameters & parameters, TripleHelix * theHelix, const double windowPropensity[3][3][3], const homotrimerScore * const * known, sharedThreadTable * shared)
+{
+    const short numRegisters = numPep*numPep*numPep*numOffsets;
+    const double slack = 1.0e-9;    // well above the rounding between a bound and the exact sum
+    const double none = -1.0e300;
+    short a, b, c, d, x, r, n;
+    short axialIndex[20], lateralIndex[20];
+    const short * threadAxial, * threadLateral;
+    pairThreadTable pairThreads;
+    double bound[numRegisters];
+    short order[numRegisters];
+    short numOrdered = 0;
+    double bestTm = none, secondTm = none, bestCCTm = none;
+    
+    // Tm is a candidate for the best, second best and (if correct) correct register.
+    auto rank = [&] (double Tm, bool correct)
+    {
+        if (Tm >= bestTm)
+        {
+            secondTm = bestTm;
+            bestTm = Tm;
+        }
+        else if (Tm > secondTm) secondTm = Tm;
+        if (correct && (Tm > bestCCTm)) bestCCTm = Tm;
+    };
+    auto correct = [] (short a, short b, short c)
+    {
+        if (numPep == 2) return (a != b) || (a != c) || (b != c);
+        if (numPep == 3) return (a != b) && (a != c) && (b != c);
+        return true;
+    };
+    auto hopeless = [&] (double Tm, short a, short b, short c)
+    {
+        if ((a == b) && (b == c)) return false;
+        return (Tm + slack < secondTm) && ((not correct(a, b, c)) || (Tm + slack < bestCCTm));
+    };
+    
+    pairThreads.reset(numOffsets, numPep);
+    pairThreads.shared = shared;
+    r = 0;
+    for (a=0; a<numPep; a++) for (b=0; b<numPep; b++) for (c=0; c<numPep; c++) for (d=0;d<numOffsets;d++,r++)
+    {
+        if ((known != NULL) && (known[a] != NULL) && (a == b) && (b == c))
+        {
+            // This homotrimer was scored for another entry of the library with the same peptide.
+            theHelix->Propensity[a][b][c][d] = known[a]->Propensity[d];
+            theHelix->PairWise[a][b][c][d] = known[a]->PairWise[d];
+            theHelix->Tm[a][b][c][d] = known[a]->Tm[d];
+            theHelix->netCharge[a][b][c][d] = known[a]->netCharge[d];
+            theHelix->totalCharge[a][b][c][d] = known[a]->totalCharge[d];
+            rank(theHelix->Tm[a][b][c][d], correct(a, b, c));
+            continue;
+        }
+        else if ((d == 0) && ((a > b) || (b > c)))
+        {
+            // As in ScoreRegisterKernel.
+            short low = a, mid = b, high = c;
+            if (low > mid) swap(low, mid);
+            if (mid > high) swap(mid, high);
+            if (low > mid) swap(low, mid);
+            theHelix->Propensity[a][b][c][d] = theHelix->Propensity[low][mid][high][d];
+            theHelix->netCharge[a][b][c][d] = theHelix->netCharge[low][mid][high][d];
+            theHelix->totalCharge[a][b][c][d] = theHelix->totalCharge[low][mid][high][d];
+        }
+        else RegisterPropensity(parameters, theHelix, windowPropensity, a, b, c, d, NULL);
+        
+        const short strand[4] = {a, b, c, a};
+        bound[r] = theHelix->Propensity[a][b][c][d];
+        for (x=0;x<3;x++)
+        {
+            pairThread & thread = pairThreads.entry(d, x, strand[x], strand[x+1]);
+            if (not thread.filled)
+            {
+                short numYaa = RegisterThreadIndex(theHelix, a, b, c, d, x, axialIndex, lateralIndex, threadAxial, threadLateral);
+                FillPairThread(parameters, threadAxial, threadLateral, numYaa, thread);
+            }
+            bound[r] += thread.bound;
+        }
+        order[numOrdered++] = r;
+    }
+    
+    // Only the few highest bounds go first; the second best and correct Tm are usually among them, and sorting the rest
+    // would cost more than it saves.
+    short numFirst = (numOrdered < 8) ? numOrdered : 8;
+    partial_sort(order, order + numFirst, order + numOrdered, [&] (short first, short second) { return bound[first] > bound[second]; });
+    for (n=0;n<numOrdered;n++)
+    {
+        r = order[n];
+        d = r % numOffsets;
+        c = (r / numOffsets) % numPep;
+        b = (r / numOffsets / numPep) % numPep;
+        a = r / numOffsets / numPep / numPep;
+        const short strand[4] = {a, b, c, a};
+        
+        if (hopeless(bound[r], a, b, c))
+        {
+            theHelix->Tm[a][b][c][d] = bound[r];
+            theHelix->PairWise[a][b][c][d] = bound[r] - theHelix->Propensity[a][b][c][d];
+            theHelix->fullTable = false;
+            continue;
+        }
+        
+        for (x=0;x<3;x++)
+        {
+            pairThread & thread = pairThreads.entry(d, x, strand[x], strand[x+1]);
+            if (not thread.known)
+            {
+                // The thread indices are only needed again to look the thread up in scoreCache.
+                if (scoreCache.enabled)
+                {
+                    short numYaa = RegisterThreadIndex(theHelix, a, b, c, d, x, axialIndex, lateralIndex, threadAxial, threadLateral);
+                    SolvePairThread(parameters, threadAxial, threadLateral, numYaa, thread);
+                }
+                else
+                {
+                    PROFILE_COUNT(profilePairThread, thread.lastPair + 1);
+                    thread.stabilizing = PairWiseCalc(thread.XPW, thread.LPW, thread.lastPair);
+                    thread.known = true;
+                }
+            }
+            AddThreadPairWise(thread, (x == 0), theHelix->PairWise[a][b][c][d]);
+        }
+        theHelix->Tm[a][b][c][d] = theHelix->Propensity[a][b][c][d] + theHelix->PairWise[a][b][c][d];
+        rank(theHelix->Tm[a][b][c][d], correct(a, b, c));
+    }
+}
+
+// RankedRegisterKernel for a helix of two or three peptides.
+void RankedRegisters (const scoringParameters & parameters, TripleHelix * theHelix, const double windowPropensity[3][3][3], const homotrimerScore * const * known, sharedThreadTable * shared)
+{
+    PROFILE_SPAN(profileScoreRegisters);
+    if (theHelix->numOffsets == 9)
+    {
+        if (theHelix->numPep == 2) RankedRegisterKernel<2, 9>(parameters, theHelix, windowPropensity, known, shared);
+        else RankedRegisterKernel<3, 9>(parameters, theHelix, windowPropensity, known, shared);
+    }
+    else
+    {
+        if (theHelix->numPep == 2) RankedRegisterKernel<2, 1>(parameters, theHelix, windowPropensity, known, shared);
+        else RankedRegisterKernel<3, 1>(parameters, theHelix, windowPropensity, known, shared);
+    }
+}
+
+// Finds the best, second best and correct (CC) compositions / registers of theHelix from its Tm tables, taking them in
+// the order ScoreRegisters scores them, and sets the deviation from them.
+template <short numPep, short numOffsets>
+void RankRegisterKernel (TripleHelix * theHelix)
+{
+    short a, b, c, d;
+    
+    double maxTm, secondBestTm;
+    double bestReg[4], secondBestReg[4];
+    secondBestTm = -2000;
+    secondBestReg[0] = 5;
+    secondBestReg[1] = 5;
+    secondBestReg[2] = 5;
+    secondBestReg[3] = 10;
+    
+    maxTm = -1000;
+    bestReg[0] = 6;
     bestReg[1] = 6;
     bestReg[2] = 6;
     bestReg[3] = 11;
     
-    theHelix->CCTm = -1500;
-    theHelix->CCRegister[0] = 7;
-    theHelix->CCRegister[1] = 7;
-    theHelix->CCRegister[2] = 7;
-    theHelix->CCRegister[3] = 12;
+    theHelix->CCTm = -1500;
+    theHelix->CCRegister[0] = 7;
+    theHelix->CCRegister[1] = 7;
+    theHelix->CCRegister[2] = 7;
+    theHelix->CCRegister[3] = 12;
+    
+    for (a=0; a<numPep; a++) for (b=0; b<numPep; b++) for (c=0; c<numPep; c++) for (d=0;d<numOffsets;d++)
+    {
+        // Determine if this is the best and remember the best & second best registers.
+        if (theHelix->Tm[a][b][c][d] >= maxTm)
+        {
+            secondBestTm = maxTm;
+            secondBestReg[0] = bestReg[0];
+            secondBestReg[1] = bestReg[1];
+            secondBestReg[2] = bestReg[2];
+            secondBestReg[3] = bestReg[3];
+            
+            maxTm = theHelix->Tm[a][b][c][d];
+            bestReg[0] = a;
+            bestReg[1] = b;
+            bestReg[2] = c;
+            bestReg[3] = d;
+        }
+        else
+        {
+            if (theHelix->Tm[a][b][c][d] >= secondBestTm)
+            {
+                secondBestTm = theHelix->Tm[a][b][c][d];
+                secondBestReg[0] = a;
+                secondBestReg[1] = b;
+                secondBestReg[2] = c;
+                secondBestReg[3] = d;
+            }
+        }
+        
+        if (numPep == 1)
+        {
+            if (theHelix->Tm[a][b][c][d] >= theHelix->CCTm)
+            {
+                //cout << "Setting CCTm for homotrimer" << endl;
+                theHelix->CCTm = theHelix->Tm[a][b][c][d];
+                theHelix->CCRegister[0] = a;
+                theHelix->CCRegister[1] = b;
+                theHelix->CCRegister[2] = c;
+            }
+        }
+        
+        if ((numPep == 2) && ((a != b) || (a != c) || (b != c)))
+        {
+            
+            if (theHelix->Tm[a][b][c][d] >= theHelix->CCTm)
+            {
+                //cout << "This is an A2B register: " << n << " " <<bestReg[0]<<bestReg[1]<<bestReg[2] << endl;
+                theHelix->CCTm = theHelix->Tm[a][b][c][d];
+                theHelix->CCRegister[0] = a;
+                theHelix->CCRegister[1] = b;
+                theHelix->CCRegister[2] = c;
+                theHelix->CCRegister[3] = d;
+            }
+        }
+            
+        if ((numPep == 3) && ((a != b) && (a != c) && (b != c)))
+        {
+            
+            if (theHelix->Tm[a][b][c][d] >= theHelix->CCTm)
+            {
+                //cout << "This is an ABC register: " << n << " " <<bestReg[0]<<bestReg[1]<<bestReg[2] << endl;
+                theHelix->CCTm = theHelix->Tm[a][b][c][d];
+                theHelix->CCRegister[0] = a;
+                theHelix->CCRegister[1] = b;
+                theHelix->CCRegister[2] = c;
+                theHelix->CCRegister[3] = d;
+            }
+        }
+        
+        
+    } // end for abcd
+    
+    
+    // move all values to the helix parameters...
+    theHelix->HighTm = maxTm;
+    theHelix->bestRegister[0] = bestReg[0];
+    theHelix->bestRegister[1] = bestReg[1];
+    theHelix->bestRegister[2] = bestReg[2];
+    theHelix->bestRegister[3] = bestReg[3];
+    theHelix->bestPropensity = theHelix->Propensity[theHelix->bestRegister[0]][theHelix->bestRegister[1]][theHelix->bestRegister[2]][theHelix->bestRegister[3]];
+    theHelix->bestPairwise = theHelix->PairWise[theHelix->bestRegister[0]][theHelix->bestRegister[1]][theHelix->bestRegister[2]][theHelix->bestRegister[3]];
+    theHelix->secTm = secondBestTm;
+    theHelix->secRegister[0] = secondBestReg[0];
+    theHelix->secRegister[1] = secondBestReg[1];
+    theHelix->secRegister[2] = secondBestReg[2];
+    theHelix->secRegister[3] = secondBestReg[3];
+    theHelix->specificity = maxTm - secondBestTm;
+    // This sets the deviation as between the experimental Tm and the correct composition / register found here.
+    // This was originally created to allow known systems that have POGn peptides with high Tm to be scored for
+    // their ABC or A2B helix. However it likely introduces some problems in optimization.
+    // theHelix->deviation = theHelix->CCTm - theHelix->expTm;
+    // // // // // // // // // // // //
+    // Using maxTm is more rigorous but has its own set of problems.
+    // theHelix->deviation = maxTm - theHelix->expTm;
+    // Third option uses maxTm and the differenct between maxTm and CCTm for the difference score
+    
+    if ((theHelix->CCRegister[0] == theHelix->bestRegister[0]) && (theHelix->CCRegister[1] == theHelix->bestRegister[1]) && (theHelix->CCRegister[2] == theHelix->bestRegister[2]))
+    {
+        // The best register and expected register (CCregisters) are the same. This does not consider non-canonical registers.
+        if (theHelix->expTm == -10)
+        {
+            // an experimental Tm of -10 indicates that no transition was observed experimentally. Only penalize Tm's higher than 10C.
+            if (maxTm <= 10) theHelix->deviation = 0; else theHelix->deviation = maxTm - 10;
+        }
+        else
+            theHelix->deviation = maxTm - theHelix->expTm;
+    }
+    else
+    {
+        // The best register and the expected register are not the same.
+        // Score as above but with additional penalty for wrong register.
+        if (theHelix->expTm == -10)
+        {
+            if (maxTm <= 10) theHelix->deviation = 0;
+            if (maxTm >  10) theHelix->deviation = maxTm - 10;
+        }
+        else
+        {
+            theHelix->deviation = theHelix->CCTm - theHelix->expTm;
+            if (theHelix->deviation < 0)
+            {
+                // cout << "Deviation was: " << theHelix->deviation << ". Penalty of " << -0.5*(abs(theHelix->CCTm - maxTm)) << " applied. Final Deviation: ";
+                theHelix->deviation -= 0.5*(abs(theHelix->CCTm - maxTm));
+                //cout <<  theHelix->deviation << endl;
+            }
+            else
+            {
+                // cout << "Deviation was: " << theHelix->deviation << ". Penalty of " << 0.5*(abs(theHelix->CCTm - maxTm)) << " applied. Final Deviation: ";
+                theHelix->deviation += 0.5*(abs(theHelix->CCTm - maxTm));
+                //cout <<  theHelix->deviation << endl;
+            }
+        }
+    }
+    
+
+    
+    
+}
+
+void RankRegisters (TripleHelix * theHelix)
+{
+    PROFILE_SPAN(profileRankRegisters);
+    if (theHelix->numOffsets == 9)
+    {
+        if (theHelix->numPep == 1) RankRegisterKernel<1, 9>(theHelix);
+        else if (theHelix->numPep == 2) RankRegisterKernel<2, 9>(theHelix);
+        else RankRegisterKernel<3, 9>(theHelix);
+    }
+    else
+    {
+        if (theHelix->numPep == 1) RankRegisterKernel<1, 1>(theHelix);
+        else if (theHelix->numPep == 2) RankRegisterKernel<2, 1>(theHelix);
+        else RankRegisterKernel<3, 1>(theHelix);
+    }
+}
+
+// Only the canonical offset {012} is scored unless allOffsets is true, in which case all nine offsets are.
+// known[p], if given and not NULL, is the already scored homotrimer of peptide p, and shared, if given, holds threads
+// already solved (see ScoreEntries). With topTwoScoring only the registers that can rank are scored (see RankedRegisterKernel).
+void ScoreHelix (const scoringParameters & parameters, TripleHelix * theHelix, bool allOffsets = false, const homotrimerScore * const * known = NULL, sharedThreadTable * shared = NULL)
+{
+    PROFILE_SPAN(profileScoreHelix);
+    // Every register the helix has is set by ScoreRegisters below, so the tables aren't cleared first. The entries of
+    // registers it doesn't have (peptides past numPep, offsets past numOffsets) are never read.
+    short numOffsets = 1;
+    if (allOffsets) numOffsets = 9;
+    theHelix->numOffsets = numOffsets;
+    
+    // // // // // // // // // // // //
+    // Single AA Score of each strand //
+    // // // // // // // // // // // //
+    // Propensity and charge only depend on which residues of a peptide are in the helix, not on its partners.
+    // Offsets trim 0, 3 or 6 residues (t = 0-2 triplets) and a strand keeps the window starting s = 0-t triplets in.
+    // Each window is summed once here and shared by every composition / register and offset that uses it.
+    // The window charges never change with the parameters and were counted by theHelix->encode().
+    // The window starts on a whole triplet so its residues keep the Xaa/Yaa/Gly phase they have in the full sequence.
+    double windowPropensity[3][3][3];   // [peptide][t][s]
+    WindowPropensities(parameters, theHelix, allOffsets, windowPropensity);
+    
+    theHelix->fullTable = true;
+    // A homotrimer helix has nothing to skip.
+    if (topTwoScoring && (theHelix->numPep > 1)) RankedRegisters(parameters, theHelix, windowPropensity, known, shared);
+    else ScoreRegisters(parameters, theHelix, windowPropensity, known, shared, -1);
+    RankRegisters(theHelix);
+}
+
+// Changes amino acid pos of peptide pep of theHelix, which was scored with parameters, to aa and updates its scores.
+// Only the registers that include pep can change, so only they are scored again, and the best, second best and correct
+// registers are then found again from the tables. The result is the same as scoring the edited helix with ScoreHelix,
+// which is what is done when the tables of the other registers aren't all scored (fullTable).
+// Returns false, changing nothing, if there is no such amino acid.
+bool EditResidue (const scoringParameters & parameters, TripleHelix * theHelix, short pep, short pos, char aa)
+{
+    double windowPropensity[3][3][3];
+    
+    if ((pep < 0) || (pep >= theHelix->numPep) || (pos < 0) || (pos >= theHelix->numAA)) return false;
+    
+    theHelix->sequences[pep][pos] = toupper(aa);
+    theHelix->encode();
+    if (not theHelix->fullTable)
+    {
+        ScoreHelix(parameters, theHelix, (theHelix->numOffsets == 9));
+        return true;
+    }
+    WindowPropensities(parameters, theHelix, (theHelix->numOffsets == 9), windowPropensity);
+    ScoreRegisters(parameters, theHelix, windowPropensity, NULL, NULL, pep);
+    RankRegisters(theHelix);
+    return true;
+}
+
+// The features of one register (reg[0-3] as bestRegister) of theHelix as last scored with parameters, merged by feature.
+// Returns the register's Tm. theHelix itself is left as it is.
+double RegisterFeatures (const scoringParameters & parameters, const TripleHelix & theHelix, const short reg[4], bool allOffsets, vector<featureEntry> & features)
+{
+    TripleHelix scratch = theHelix;
+    double windowPropensity[3][3][3];
+    
+    features.clear();
+    WindowPropensities(parameters, &scratch, allOffsets, windowPropensity);
+    ScoreRegister(parameters, &scratch, windowPropensity, reg[0], reg[1], reg[2], reg[3], false, &features);
+    MergeFeatures(features);
+    return scratch.Tm[reg[0]][reg[1]][reg[2]][reg[3]];
+}
+
+// The gradient of theHelix's deviation (as set by ScoreHelix) with respect to the features, as a list of features.
+// It follows the cases of ScoreHelix: the best register alone when it is the expected one or the Tm is only bounded (-10),
+// and otherwise 1.5 or 0.5 of the expected register against -0.5 or 0.5 of the best register for the wrong-register penalty.
+void DeviationGradient (const scoringParameters & parameters, const TripleHelix & theHelix, bool allOffsets, vector<featureEntry> & gradient)
+{
+    vector<featureEntry> expected;
+    double bestWeight = 1, expectedWeight = 0;
+    size_t k;
+    
+    gradient.clear();
+    if ((theHelix.expTm == -10) && (theHelix.HighTm <= 10)) return;
+    RegisterFeatures(parameters, theHelix, theHelix.bestRegister, allOffsets, gradient);
+    
+    bool sameRegister = (theHelix.CCRegister[0] == theHelix.bestRegister[0]) && (theHelix.CCRegister[1] == theHelix.bestRegister[1]) && (theHelix.CCRegister[2] == theHelix.bestRegister[2]);
+    if (sameRegister || (theHelix.expTm == -10) || (theHelix.CCRegister[3] > 8)) return;
+    
+    if ((theHelix.CCTm - theHelix.expTm) < 0)
+    {
+        expectedWeight = 1.5;
+        bestWeight = -0.5;
+    }
+    else
+    {
+        expectedWeight = 0.5;
+        bestWeight = 0.5;
+    }
+    RegisterFeatures(parameters, theHelix, theHelix.CCRegister, allOffsets, expected);
+    for (k=0;k<gradient.size();k++) gradient[k].weight *= bestWeight;
+    for (k=0;k<expected.size();k++) gradient.push_back({expected[k].feature, expected[k].weight * expectedWeight});
+    MergeFeatures(gradient);
+}
+
+// // // // // // // // // // //
+// WORKER POOL
+// // // // // // // // // // //
+// Long-lived scoring threads, created once and reused by every ScoreLibrary call and optimizer trial.
+// Each worker owns a queue of tasks. The tasks of a Run are dealt out across the queues in blocks and a worker
+// whose queue is empty takes tasks from the far end of the others (work stealing), so helices of very
+// different lengths still balance out. The thread calling Run works on the tasks too until all are done.
+
+struct poolTask
+{
+    const function<void(long)> *    job;
+    long                            item;
+    atomic<long> *                  remaining;  // tasks of this Run not yet finished
+};
+
+struct workQueue
+{
+    mutex           lock;
+    deque<poolTask> tasks;
+};
+
+struct WorkerPool
+{
+    vector<thread>      workers;
+    vector<workQueue *> queues;
+    mutex               sleepLock;
+    condition_variable  wake;       // tasks were queued or the pool is stopping
+    condition_variable  finished;   // the last task of a Run finished
+    atomic<long>        queued;
+    bool                stopping;
+    
+    // numThreads < 1 means one worker per hardware thread.
+    WorkerPool (short numThreads)
+    {
+        short w;
+        
+        queued = 0;
+        stopping = false;
+        if (numThreads < 1) numThreads = thread::hardware_concurrency();
+        if (numThreads < 1) numThreads = 1;
+        for (w=0;w<numThreads;w++) queues.push_back(new workQueue);
+        for (w=0;w<numThreads;w++) workers.push_back(thread(&WorkerPool::Work, this, w));
+    }
+    
+    ~WorkerPool ()
+    {
+        short w;
+        {
+            lock_guard<mutex> guard(sleepLock);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (w=0;w<(short)workers.size();w++) workers[w].join();
+        for (w=0;w<(short)queues.size();w++) delete queues[w];
+    }
+    
+    // A worker takes from the back of its own queue, then from the front of the others.
+    // self = -1 is the thread that called Run, which only takes from the front.
+    bool TakeTask (short self, poolTask & task)
+    {
+        short k, q;
+        
+        if (self >= 0)
+        {
+            lock_guard<mutex> guard(queues[self]->lock);
+            if (not queues[self]->tasks.empty())
+            {
+                task = queues[self]->tasks.back();
+                queues[self]->tasks.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        for (k=0;k<(short)queues.size();k++)
+        {
+            q = (self + 1 + k) % queues.size();
+            lock_guard<mutex> guard(queues[q]->lock);
+            if (not queues[q]->tasks.empty())
+            {
+                task = queues[q]->tasks.front();
+                queues[q]->tasks.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    void RunTask (poolTask & task)
+    {
+        (*task.job)(task.item);
+        if (task.remaining->fetch_sub(1) == 1)
+        {
+            lock_guard<mutex> guard(sleepLock);
+            finished.notify_all();
+        }
+    }
+    
+    void Work (short self)
+    {
+        poolTask task;
+        
+        while (true)
+        {
+            if (TakeTask(self, task))
+            {
+                RunTask(task);
+                continue;
+            }
+            unique_lock<mutex> guard(sleepLock);
+            wake.wait(guard, [this] { return (stopping || (queued > 0)); });
+            if (stopping) return;
+        }
+    }
+    
+    // Runs job(0) ... job(count-1) on the pool and returns once all of them have finished.
+    void Run (long count, const function<void(long)> & job)
+    {
+        atomic<long> remaining(count);
+        poolTask task;
+        long k;
+        short q;
+        
+        if (count <= 0) return;
+        PROFILE_COUNT(profilePoolRun, count);
+        
+        // Neighbouring items go to the same queue so a worker keeps to one block until it has to steal.
+        for (k=0;k<count;k++)
+        {
+            q = (k * (long)queues.size()) / count;
+            lock_guard<mutex> guard(queues[q]->lock);
+            queues[q]->tasks.push_back({&job, k, &remaining});
+            queued++;
+        }
+        {
+            lock_guard<mutex> guard(sleepLock);
+        }
+        wake.notify_all();
+        
+        while (remaining > 0)
+        {
+            if (TakeTask(-1, task))
+            {
+                RunTask(task);
+            }
+            else
+            {
+                unique_lock<mutex> guard(sleepLock);
+                finished.wait(guard, [&remaining] { return (remaining == 0); });
+            }
+        }
+    }
+};
+
+// Number of scoring workers. 0 (the default) is one per hardware thread. Must be set before the pool is first used.
+short scoringThreads = 0;
+
+WorkerPool & ScoringPool ()
+{
+    static WorkerPool pool(scoringThreads);
+    return pool;
+}
+
+// Scores the entries of Lib listed in entries, one pool task per helix. Entries that have the same peptides share work:
+// - An entry with the same peptides and termination as an earlier one (the training library has literal duplicates
+//   with another experimental Tm) is given that entry's tables and only ranked against its own expTm.
+// - The homotrimer registers of a peptide only depend on the peptide, the length, the phase and the termination.
+//   Peptides that appear in several entries (e.g. as A3 and within A2B / ABC helices) have their homotrimer
+//   scored with the first entry that has them, and the other entries copy it.
+// - The interaction threads between two peptides only depend on the two peptides, the length and the phase. The
+//   pairs that several entries score have their threads solved first, with the first entry that has them, and every
+//   entry with the pair uses them.
+// Peptides are told apart by their numbers in Lib.peptides, which entries that don't have them yet are given here.
+void ScoreEntries (const scoringParameters & parameters, HelixLibrary & Lib, const vector<short> & entries, bool allOffsets)
+{
+    const short numOffsets = allOffsets ? 9 : 1;
+    long k, h;
+    short p, q;
+    unordered_map<string, long> firstEntry;    // peptides and termination -> the first entry (in entries) with them
+    vector<long> duplicateOf(entries.size(), -1);
+    for (k=0;k<(long)entries.size();k++)
+    {
+        TripleHelix & theHelix = Lib[entries[k]];
+        Lib.peptides.intern(theHelix);
+        string key((const char *)theHelix.peptideID, theHelix.numPep*sizeof(long));
+        key += char(2*(theHelix.NtermType == chargedTerminus) + (theHelix.CtermType == chargedTerminus));
+        auto found = firstEntry.find(key);
+        if (found == firstEntry.end()) firstEntry[key] = k;
+        else duplicateOf[k] = found->second;
+    }
+    
+    unordered_map<long long, long> firstUse;    // key -> number of the homotrimer
+    vector<long> source;                        // entry (in entries) holding each homotrimer
+    vector<short> sourcePep;
+    vector<long> uses;
+    vector<long> homotrimer(entries.size()*3, -1);
+    for (k=0;k<(long)entries.size();k++)
+    {
+        TripleHelix & theHelix = Lib[entries[k]];
+        if (duplicateOf[k] >= 0) continue;
+        for (p=0;p<theHelix.numPep;p++)
+        {
+            long long key = 4*(long long)theHelix.peptideID[p] + 2*(theHelix.NtermType == chargedTerminus) + (theHelix.CtermType == chargedTerminus);
+            auto found = firstUse.find(key);
+            if (found == firstUse.end())
+            {
+                found = firstUse.insert(make_pair(key, (long)source.size())).first;
+                source.push_back(k);
+                sourcePep.push_back(p);
+                uses.push_back(0);
+            }
+            homotrimer[3*k+p] = found->second;
+            uses[found->second]++;
+        }
+    }
+    
+    // Score the entries that hold a shared homotrimer first, then everything else copying from them.
+    vector<bool> scored(entries.size(), false);
+    vector<long> first, rest;
+    for (h=0;h<(long)source.size();h++) if ((uses[h] > 1) && (not scored[source[h]]))
+    {
+        scored[source[h]] = true;
+        first.push_back(source[h]);
+    }
+    for (k=0;k<(long)entries.size();k++) if ((not scored[k]) && (duplicateOf[k] < 0)) rest.push_back(k);
+    
+    // Number the ordered pairs of peptides each entry scores threads for. An A3 entry that copies its homotrimer has none.
+    unordered_map<long long, long> pairNumber;
+    vector<long> pairSource;    // entry (in entries) holding each pair
+    vector<short> pairFirst, pairSecond;
+    vector<long> pairUses;
+    vector<long> pair(entries.size()*9, -1);
+    for (k=0;k<(long)entries.size();k++)
+    {
+        TripleHelix & theHelix = Lib[entries[k]];
+        if (duplicateOf[k] >= 0) continue;
+        if ((theHelix.numPep == 1) && (not scored[k]) && (uses[homotrimer[3*k]] > 1)) continue;
+        for (p=0;p<theHelix.numPep;p++) for (q=0;q<theHelix.numPep;q++)
+        {
+            long long key = ((long long)theHelix.peptideID[p] << 32) + theHelix.peptideID[q];
+            auto found = pairNumber.find(key);
+            if (found == pairNumber.end())
+            {
+                found = pairNumber.insert(make_pair(key, (long)pairSource.size())).first;
+                pairSource.push_back(k);
+                pairFirst.push_back(p);
+                pairSecond.push_back(q);
+                pairUses.push_back(0);
+            }
+            pair[9*k+3*p+q] = found->second;
+            pairUses[found->second]++;
+        }
+    }
+    
+    // Solve the threads of the pairs that several entries have, one task per pair. Thread k of a register runs from
+    // strand k to the next (see pairThreadTable), so the register's other strand doesn't matter.
+    vector<long> sharedPair(pairSource.size(), -1);
+    vector<long> solveList;
+    for (h=0;h<(long)pairSource.size();h++) if (pairUses[h] > 1)
+    {
+        sharedPair[h] = solveList.size();
+        solveList.push_back(h);
+    }
+    vector<pairThread> solved(solveList.size()*numOffsets*3);
+    ScoringPool().Run(solveList.size(), [&] (long item)
+    {
+        long h = solveList[item];
+        TripleHelix * theHelix = &Lib[entries[pairSource[h]]];
+        short axialIndex[20], lateralIndex[20];
+        const short * threadAxial, * threadLateral;
+        for (short d=0;d<numOffsets;d++) for (short x=0;x<3;x++)
+        {
+            pairThread & thread = solved[(item*numOffsets + d)*3 + x];
+            thread.filled = false;
+            thread.known = false;
+            if ((d == 0) && (x == 1)) continue; // the same as the first
+            short strand[3] = {0, 0, 0};
+            strand[x] = pairFirst[h];
+            strand[(x+1)%3] = pairSecond[h];
+            short numYaa = RegisterThreadIndex(theHelix, strand[0], strand[1], strand[2], d, x, axialIndex, lateralIndex, threadAxial, threadLateral);
+            SolvePairThread(parameters, threadAxial, threadLateral, numYaa, thread);
+        }
+    });
+    
+    // The solved threads entry k uses, as ScoreHelix takes them.
+    auto shareThreads = [&] (long k, sharedThreadTable & shared)
+    {
+        short d, x, p, q;
+        for (d=0;d<numOffsets;d++) for (x=0;x<3;x++) for (p=0;p<3;p++) for (q=0;q<3;q++)
+        {
+            shared[d][x][p][q] = NULL;
+            if ((pair[9*k+3*p+q] < 0) || (sharedPair[pair[9*k+3*p+q]] < 0)) continue;
+            shared[d][x][p][q] = &solved[(sharedPair[pair[9*k+3*p+q]]*numOffsets + d)*3 + x];
+        }
+    };
+    
+    ScoringPool().Run(first.size(), [&] (long item)
+    {
+        sharedThreadTable shared;
+        shareThreads(first[item], shared);
+        ScoreHelix(parameters, &Lib[entries[first[item]]], allOffsets, NULL, &shared);
+    });
+    
+    vector<homotrimerScore> known(source.size());
+    for (h=0;h<(long)source.size();h++) if (uses[h] > 1)
+    {
+        TripleHelix * from = &Lib[entries[source[h]]];
+        p = sourcePep[h];
+        for (short d=0;d<9;d++)
+        {
+            known[h].Tm[d] = from->Tm[p][p][p][d];
+            known[h].Propensity[d] = from->Propensity[p][p][p][d];
+            known[h].PairWise[d] = from->PairWise[p][p][p][d];
+            known[h].netCharge[d] = from->netCharge[p][p][p][d];
+            known[h].totalCharge[d] = from->totalCharge[p][p][p][d];
+        }
+    }
+    
+    ScoringPool().Run(rest.size(), [&] (long item)
+    {
+        const homotrimerScore * knownPep[3] = {NULL, NULL, NULL};
+        sharedThreadTable shared;
+        long k = rest[item];
+        for (short q=0;q<Lib[entries[k]].numPep;q++)
+        {
+            long h = homotrimer[3*k+q];
+            if (uses[h] > 1) knownPep[q] = &known[h];
+        }
+        shareThreads(k, shared);
+        ScoreHelix(parameters, &Lib[entries[k]], allOffsets, knownPep, &shared);
+    });
+    
+    for (k=0;k<(long)entries.size();k++) if (duplicateOf[k] >= 0)
+    {
+        const TripleHelix & from = Lib[entries[duplicateOf[k]]];
+        TripleHelix & to = Lib[entries[k]];
+        to.numOffsets = from.numOffsets;
+        to.fullTable = from.fullTable;
+        memcpy(to.Propensity, from.Propensity, sizeof(to.Propensity));
+        memcpy(to.PairWise, from.PairWise, sizeof(to.PairWise));
+        memcpy(to.Tm, from.Tm, sizeof(to.Tm));
+        memcpy(to.netCharge, from.netCharge, sizeof(to.netCharge));
+        memcpy(to.totalCharge, from.totalCharge, sizeof(to.totalCharge));
+        RankRegisters(&to);
+    }
+}
+
+// Scores helices start ... stop-1 of Lib (see ScoreEntries).
+void ScoreLibrary (short start, short stop, const scoringParameters & parameters, HelixLibrary & Lib, bool allOffsets)
+{
+    vector<short> entries;
+    short n;
+    
+    for (n=start;n<stop;n++) entries.push_back(n);
+    ScoreEntries(parameters, Lib, entries, allOffsets);
+}
+
+// // // // // // // // // // //
+// Scoring under several parameter sets
+// // // // // // // // // // //
+// Comparing parameter files (parameters.txt, the experimental values, fitted newParameters.txt ...) over one library
+// used to take a run and a parse per file. ScoreLibrarySets scores every helix under all of them in one pass. A helix's
+// residues, windows and interaction thread indices are set up once, and each of its interaction threads is filled and
+// solved for every set together. The axial and lateral tables are laid out set after set for each entry (a structure of
+// arrays), so the inner loops run across the sets. Each set's scores are the same as ScoreHelix gives with that set.
+
+struct parameterSets
+{
+    vector<const scoringParameters *>   sets;
+    vector<string>                      names;
+    short                               count = 0;
+    vector<double>                      axial;      // axial[(27*x + y)*count + s] is axial[x][y] of set s
+    vector<double>                      lateral;
+    
+    void add (const scoringParameters & parameters, string name)
+    {
+        sets.push_back(&parameters);
+        names.push_back(name);
+        count = sets.size();
+    };
+    
+    // Lays out the tables once every set was added. The sets must not change after this.
+    void arrange (void)
+    {
+        short s, k;
+        
+        axial.resize(27*27*count);
+        lateral.resize(27*27*count);
+        for (k=0;k<27*27;k++) for (s=0;s<count;s++)
+        {
+            axial[k*count + s] = (&sets[s]->axial[0][0])[k];
+            lateral[k*count + s] = (&sets[s]->lateral[0][0])[k];
+        }
+    };
+};
+
+// The propensity of each window of each peptide under one set, see ScoreHelix.
+struct windowTable
+{
+    double  window[3][3][3];
+};
+
+// What ScoreHelix leaves in a helix for one parameter set.
+struct setScore
+{
+    double  HighTm, CCTm, specificity, deviation;
+    short   bestRegister[4];
+};
+
+// PairWiseCalc of count interaction threads side by side. Thread s has its values in XPW[i*count + s] and
+// LPW[i*count + s] and its maximum goes to best[s]. sums is scratch for 3*count values. Each lane makes the same
+// comparisons and sums in the same order as PairWiseCalc, so the maxima are identical.
+void PairWiseCalcSets (const double XPW[], const double LPW[], short lastPair, short count, double sums[], double best[])
+{
+    const double impossible = -1.0e9; // see PairWiseCalc
+    double * noneSum = sums;
+    double * latSum = sums + count;
+    double * axSum = sums + 2*count;
+    double notAxialSum, latGain, axGain, newNone, newLat, newAx;
+    short currentPair, s;
+    
+    for (s=0;s<count;s++)
+    {
+        noneSum[s] = impossible;
+        latSum[s] = 0;
+        axSum[s] = impossible;
+    }
+    for (currentPair=0; currentPair<lastPair; currentPair++)
+    {
+        const double * X = XPW + currentPair*count;
+        const double * L = LPW + currentPair*count;
+        for (s=0;s<count;s++)
+        {
+            latGain = (L[s] > 0) ? L[s] : 0;
+            axGain = (X[s] > 0) ? X[s] : 0;
+            notAxialSum = (noneSum[s] > latSum[s]) ? noneSum[s] : latSum[s];
+            newNone = (latSum[s] > axSum[s]) ? latSum[s] : axSum[s];
+            newLat = notAxialSum + latGain;
+            newAx = ((newLat + axGain) > (axSum[s] + axGain)) ? (newLat + axGain) : (axSum[s] + axGain);
+            noneSum[s] = newNone;
+            latSum[s] = newLat;
+            axSum[s] = newAx;
+        }
+    }
+    for (s=0;s<count;s++)
+    {
+        latGain = (LPW[lastPair*count + s] > 0) ? LPW[lastPair*count + s] : 0;
+        best[s] = 0;
+        if (latSum[s] > best[s]) best[s] = latSum[s];
+        if (axSum[s] > best[s]) best[s] = axSum[s];
+        if ((noneSum[s] + latGain) > best[s]) best[s] = noneSum[s] + latGain;
+    }
+}
+
+// Scores theHelix under every set of sets, as ScoreHelix would under each, into scores[0 ... sets.count-1].
+void ScoreHelixSets (const parameterSets & sets, const TripleHelix & theHelix, bool allOffsets, setScore scores[])
+{
+    const short count = sets.count;
+    const short numPep = theHelix.numPep;
+    const short numOffsets = allOffsets ? 9 : 1;
+    const short numRegisters = numPep*numPep*numPep*numOffsets;
+    short a, b, c, d, s, x, i;
+    long r;
+    
+    // scratch is scored under one set at a time; the propensity and pairwise part of register r under set s are kept
+    // in propensity[r*count + s] and pairWise[r*count + s].
+    TripleHelix scratch = theHelix;
+    scratch.numOffsets = numOffsets;
+    vector<windowTable> windows(count);
+    for (s=0;s<count;s++) WindowPropensities(*sets.sets[s], &scratch, allOffsets, windows[s].window);
+    vector<double> propensity(numRegisters*count), pairWise(numRegisters*count);
+    auto registerNumber = [&] (short lead, short mid, short trail, short offset) { return ((lead*numPep + mid)*numPep + trail)*numOffsets + offset; };
+    
+    // The solved threads, as in pairThreadTable: [offset][thread][first][second], each the values of the thread under
+    // every set followed by their maxima.
+    const short lastPair = theHelix.numAA / 3;
+    const long stride = (2*(lastPair+1) + 1) * count;
+    const long numThreads = numOffsets*3*numPep*numPep;
+    unique_ptr<double[]> threads(new double[numThreads * stride]);
+    vector<bool> known(numThreads, false);
+    vector<double> sums(3*count);
+    short axialIndex[20], lateralIndex[20];
+    
+    for (a=0; a<numPep; a++) for (b=0; b<numPep; b++) for (c=0; c<numPep; c++) for (d=0;d<numOffsets;d++)
+    {
+        r = registerNumber(a, b, c, d);
+        
+        // The propensity as in ScoreRegisters, including taking it from the sorted permutation on the canonical offset.
+        if ((d == 0) && ((a > b) || (b > c)))
+        {
+            short low = a, mid = b, high = c;
+            if (low > mid) swap(low, mid);
+            if (mid > high) swap(mid, high);
+            if (low > mid) swap(low, mid);
+            for (s=0;s<count;s++) propensity[r*count + s] = propensity[registerNumber(low, mid, high, d)*count + s];
+            scratch.netCharge[a][b][c][d] = scratch.netCharge[low][mid][high][d];
+            scratch.totalCharge[a][b][c][d] = scratch.totalCharge[low][mid][high][d];
+        }
+        else for (s=0;s<count;s++)
+        {
+            RegisterPropensity(*sets.sets[s], &scratch, windows[s].window, a, b, c, d, NULL);
+            propensity[r*count + s] = scratch.Propensity[a][b][c][d];
+        }
+        
+        short maxShift = max(offsetMidShift[d], offsetTrailShift[d]);
+        short trimmedNumAA = theHelix.numAA - maxShift;
+        short numYaa = trimmedNumAA / 3;
+        const short strand[4] = {a, b, c, a};
+        const short strandStart[4] = {maxShift, (short)(maxShift - offsetMidShift[d]), (short)(maxShift - offsetTrailShift[d]), maxShift};
+        const short axialShift[3] = {2, 2, 5};
+        const short lateralShift[3] = {-1, -1, 2};
+        for (x=0;x<3;x++)
+        {
+            long entry = ((d*3 + (((d == 0) && (x == 1)) ? 0 : x))*numPep + strand[x])*numPep + strand[x+1];
+            double * XPW = &threads[entry*stride];
+            double * LPW = XPW + (lastPair+1)*count;
+            double * stabilizing = LPW + (lastPair+1)*count;
+            if (not known[entry])
+            {
+                const short * threadAxial = theHelix.threadAxialIndex[x/2][strand[x]][strand[x+1]];
+                const short * threadLateral = theHelix.threadLateralIndex[x/2][strand[x]][strand[x+1]];
+                if (d != 0)
+                {
+                    scratch.BuildThreadIndex(strand[x], strandStart[x], strand[x+1], strandStart[x+1], trimmedNumAA, axialShift[x], lateralShift[x], numYaa, axialIndex, lateralIndex);
+                    threadAxial = axialIndex;
+                    threadLateral = lateralIndex;
+                }
+                for (i=0;i<=numYaa;i++) for (s=0;s<count;s++)
+                {
+                    XPW[i*count + s] = (threadAxial[i] >= 0) ? sets.axial[threadAxial[i]*count + s] : 0;
+                    LPW[i*count + s] = (threadLateral[i] >= 0) ? sets.lateral[threadLateral[i]*count + s] : 0;
+                }
+                PairWiseCalcSets(XPW, LPW, numYaa, count, &sums[0], stabilizing);
+                known[entry] = true;
+            }
+            
+            // Summed in the same order as ScoreRegister.
+            for (s=0;s<count;s++)
+            {
+                double & sum = pairWise[r*count + s];
+                if (x == 0) sum = stabilizing[s]; else sum += stabilizing[s];
+                for (i=0;i<numYaa;i++)
+                {
+                    if (XPW[i*count + s] < 0) sum += XPW[i*count + s];
+                    if (LPW[i*count + s] < 0) sum += LPW[i*count + s];
+                }
+            }
+        }
+    }
+    
+    for (s=0;s<count;s++)
+    {
+        for (a=0; a<numPep; a++) for (b=0; b<numPep; b++) for (c=0; c<numPep; c++) for (d=0;d<numOffsets;d++)
+        {
+            r = registerNumber(a, b, c, d);
+            scratch.Propensity[a][b][c][d] = propensity[r*count + s];
+            scratch.PairWise[a][b][c][d] = pairWise[r*count + s];
+            scratch.Tm[a][b][c][d] = propensity[r*count + s] + pairWise[r*count + s];
+        }
+        RankRegisters(&scratch);
+        scores[s].HighTm = scratch.HighTm;
+        scores[s].CCTm = scratch.CCTm;
+        scores[s].specificity = scratch.specificity;
+        scores[s].deviation = scratch.deviation;
+        for (i=0;i<4;i++) scores[s].bestRegister[i] = scratch.bestRegister[i];
+    }
+}
+
+// Scores helices 0 ... TotalHelices-1 of Lib under every set, one pool task per helix.
+// Returns the helix x set matrix: the scores of helix n under set s are entry n*sets.count + s.
+vector<setScore> ScoreLibrarySets (const parameterSets & sets, HelixLibrary & Lib, long TotalHelices, bool allOffsets)
+{
+    vector<setScore> scores(TotalHelices * sets.count);
+    ScoringPool().Run(TotalHelices, [&] (long n) { ScoreHelixSets(sets, Lib[n], allOffsets, &scores[n*sets.count]); });
+    return scores;
+}
+
+// Writes the helix x set matrix of CCTm (the Tm compared with expTm) as csv to name, "-" for the standard output,
+// and shows the sum of squared deviations under each set.
+void WriteSetScores (const parameterSets & sets, HelixLibrary & Lib, long TotalHelices, const vector<setScore> & scores, string name)
+{
+    ofstream file;
+    ostream * out = &file;
+    long n;
+    short s;
+    
+    if (name == "-") out = &cout;
+    else
+    {
+        file.open(name);
+        if (not file.is_open())
+        {
+            cout << "We couldn't open " << name << "." << endl;
+            return;
+        }
+    }
+    // Numbers are written as the library records write them, and the rows a block at a time.
+    string pending = "helix,numPep,numAA,expTm";
+    for (s=0;s<sets.count;s++)
+    {
+        pending += ",";
+        AppendCsv(pending, sets.names[s]);
+    }
+    pending += "\n";
+    for (n=0;n<TotalHelices;n++)
+    {
+        pending += to_string(n+1) + "," + to_string(Lib[n].numPep) + "," + to_string(Lib[n].numAA) + ",";
+        AppendNumber(pending, Lib[n].expTm);
+        for (s=0;s<sets.count;s++)
+        {
+            pending += ",";
+            AppendNumber(pending, scores[n*sets.count + s].CCTm);
+        }
+        pending += "\n";
+        if (pending.size() >= (1 << 16))
+        {
+            out->write(pending.data(), pending.size());
+            pending.clear();
+        }
+    }
+    out->write(pending.data(), pending.size());
+    out->flush();
+    if (name != "-") cout << "CCTm of " << TotalHelices << " helices under " << sets.count << " parameter sets written to " << name << endl;
+    
+    for (s=0;s<sets.count;s++)
+    {
+        double sumSquaredDev = 0;
+        for (n=0;n<TotalHelices;n++) sumSquaredDev += scores[n*sets.count + s].deviation * scores[n*sets.count + s].deviation;
+        cout << sets.names[s] << ": Sum of Squared Deviation = " << sumSquaredDev << ", Average = " << sumSquaredDev / TotalHelices << endl;
+    }
+}
+
+// One single substitution of a scored helix and how the helix scores with it, see MutationScan.
+struct mutationResult
+{
+    short   pep, pos;
+    char    from, to;
+    double  HighTm, specificity, CCTm;
+    short   bestRegister[4];
+};
+
+// The residues MutationScan tries at every Xaa and Yaa position.
+const string scanResidues = "ACDEFHIKLMNOPQRSTVWY";
+
+// Scores theHelix, already scored with parameters, with every single substitution of an Xaa or Yaa position of any of
+// its peptides by each residue of scanResidues other than the one already there. The positions are shared out over the
+// scoring pool; each one works on its own copy of the helix and steps through the residues with EditResidue.
+// The results are in the order of peptide, position and scanResidues. If stop is given and becomes true while the scan
+// runs, the positions not yet started are skipped and the results are incomplete.
+vector<mutationResult> MutationScan (const scoringParameters & parameters, const TripleHelix & theHelix, const atomic<bool> * stop = NULL)
+{
+    vector<short> positionPep, positionAA;
+    vector<mutationResult> results;
+    short p, x, r;
+    long k;
+    
+    for (p=0;p<theHelix.numPep;p++) for (x=0;x<theHelix.numAA;x++) if (theHelix.phase[x] != 2)
+    {
+        positionPep.push_back(p);
+        positionAA.push_back(x);
+    }
+    
+    const short numResidues = scanResidues.size();
+    vector<mutationResult> scanned(positionPep.size() * numResidues);
+    ScoringPool().Run(positionPep.size(), [&] (long item)
+    {
+        if ((stop != NULL) && *stop) return;
+        TripleHelix scratch = theHelix;
+        short pep = positionPep[item], pos = positionAA[item];
+        for (short q=0;q<numResidues;q++)
+        {
+            mutationResult & result = scanned[item*numResidues + q];
+            result.pep = pep;
+            result.pos = pos;
+            result.from = theHelix.sequences[pep][pos];
+            result.to = scanResidues[q];
+            if (result.to == result.from) continue;
+            EditResidue(parameters, &scratch, pep, pos, result.to);
+            result.HighTm = scratch.HighTm;
+            result.specificity = scratch.specificity;
+            result.CCTm = scratch.CCTm;
+            for (r=0;r<4;r++) result.bestRegister[r] = scratch.bestRegister[r];
+        }
+    });
+    
+    for (k=0;k<(long)scanned.size();k++) if (scanned[k].to != scanned[k].from) results.push_back(scanned[k]);
+    return results;
+}
+
+// Shows the top substitutions of a MutationScan by Tm, by specificity and by CCTm, next to the unchanged helix.
+void ReportMutations (const TripleHelix & theHelix, vector<mutationResult> results, short top)
+{
+    const string ranking[3] = {"Tm", "specificity", "CCTm"};
+    short k, r;
+    
+    cout << results.size() << " single substitutions scored. Unchanged: Tm = " << theHelix.HighTm << ", specificity = " << theHelix.specificity << ", CCTm = " << theHelix.CCTm << "." << endl;
+    for (r=0;r<3;r++)
+    {
+        stable_sort(results.begin(), results.end(), [r] (const mutationResult & first, const mutationResult & second)
+        {
+            if (r == 0) return first.HighTm > second.HighTm;
+            if (r == 1) return first.specificity > second.specificity;
+            return first.CCTm > second.CCTm;
+        });
+        cout << endl << "Highest " << ranking[r] << ":" << endl;
+        for (k=0;(k<top) && (k<(short)results.size());k++)
+        {
+            const mutationResult & result = results[k];
+            cout << "Peptide " << result.pep << " #" << result.pos << " " << result.from << "->" << result.to;
+            cout << "\tTm = " << result.HighTm << "\tspecificity = " << result.specificity << "\tCCTm = " << result.CCTm;
+            cout << "\t{" << result.bestRegister[0] << result.bestRegister[1] << result.bestRegister[2] << "}";
+            if (result.bestRegister[3] != 0) cout << " " << offsetName[result.bestRegister[3]];
+            cout << endl;
+        }
+    }
+    cout << endl;
+}
+
+// // // // // // // // // // //
+// Background scoring
+// // // // // // // // // // //
+// For an interface that must never wait for the scoring, such as the event loop of the redesigned GUI. A helixSession
+// keeps its own copy of the helix being worked on and scores it on a thread of its own. Edit, Change and Scan return at
+// once with a future of the result, and the callback given with the request, if any, is called with the same result
+// when it is ready. Callbacks run on the session's thread, so a GUI should only post them on to its own loop.
+// Requests are answered in the order they were made. When several are waiting only the newest is scored: the edits
+// before it are still made but answered as stale, so a user who keeps typing is only answered for the helix as it is
+// now. Edits go through EditResidue, which only scores the registers of the edited peptide again.
+enum sessionRequestType { editRequest, helixRequest, scanRequest };
+
+// The answer to one request of a helixSession.
+struct sessionResult
+{
+    long                            request = 0;    // 1 is the first request of the session
+    bool                            stale = false;  // a newer request or Cancel came first, so nothing was scored for this one
+    bool                            applied = true; // false for an edit of an amino acid the helix doesn't have
+    shared_ptr<const TripleHelix>   helix;          // the helix as it was after the request, scored. NULL when stale.
+    vector<mutationResult>          scan;           // of a scan request, as MutationScan gives them: a heatmap by peptide, position and scanResidues
+};
+
+typedef function<void(const sessionResult &)> sessionCallback;
+
+struct sessionRequest
+{
+    sessionRequestType          type;
+    long                        number;
+    short                       pep, pos;
+    char                        aa;
+    TripleHelix                 helix;      // the new helix of a helixRequest
+    sessionCallback             done;
+    promise<sessionResult>      answer;
+};
+
+struct helixSession
+{
+    scoringParameters                   parameters;
+    bool                                allOffsets;
+    TripleHelix                         current;            // only used by the session's thread
+    mutex                               lock;
+    condition_variable                  wake;
+    deque< unique_ptr<sessionRequest> > waiting;
+    long                                lastRequest = 0;
+    long                                cancelledUpTo = 0;  // requests up to this one are answered as stale
+    bool                                stopping = false;
+    atomic<bool>                        interrupted;        // a request came in or Cancel was called since the session's thread last looked
+    thread                              worker;
+    
+    // start must already be scored with theParameters, as by ScoreHelix with theAllOffsets. The parameters are copied.
+    helixSession (const scoringParameters & theParameters, const TripleHelix & start, bool theAllOffsets) : parameters(theParameters), allOffsets(theAllOffsets), current(start)
+    {
+        interrupted = false;
+        worker = thread(&helixSession::Work, this);
+    }
+    
+    // Whatever is still waiting is answered as stale.
+    ~helixSession ()
+    {
+        {
+            lock_guard<mutex> guard(lock);
+            stopping = true;
+            interrupted = true;
+        }
+        wake.notify_all();
+        worker.join();
+    }
+    
+    // Changes amino acid pos of peptide pep to aa.
+    future<sessionResult> Edit (short pep, short pos, char aa, sessionCallback done = NULL)
+    {
+        unique_ptr<sessionRequest> request(new sessionRequest);
+        request->type = editRequest;
+        request->pep = pep;
+        request->pos = pos;
+        request->aa = aa;
+        request->done = done;
+        return Submit(request);
+    }
+    
+    // Works on theHelix from now on, which must be ready to score (as after determine_reptition).
+    future<sessionResult> Change (const TripleHelix & theHelix, sessionCallback done = NULL)
+    {
+        unique_ptr<sessionRequest> request(new sessionRequest);
+        request->type = helixRequest;
+        request->helix = theHelix;
+        request->done = done;
+        return Submit(request);
+    }
+    
+    // Every single substitution of the helix, see MutationScan. A newer request stops the scan.
+    future<sessionResult> Scan (sessionCallback done = NULL)
+    {
+        unique_ptr<sessionRequest> request(new sessionRequest);
+        request->type = scanRequest;
+        request->done = done;
+        return Submit(request);
+    }
+    
+    // Answers everything asked for so far that isn't on its way yet as stale, and stops a scan. Edits are still made.
+    void Cancel (void)
+    {
+        lock_guard<mutex> guard(lock);
+        cancelledUpTo = lastRequest;
+        interrupted = true;
+    }
+    
+    future<sessionResult> Submit (unique_ptr<sessionRequest> & request)
+    {
+        future<sessionResult> result = request->answer.get_future();
+        {
+            lock_guard<mutex> guard(lock);
+            request->number = ++lastRequest;
+            waiting.push_back(move(request));
+            interrupted = true;
+        }
+        wake.notify_one();
+        return result;
+    }
+    
+    void Deliver (sessionRequest & request, sessionResult & result)
+    {
+        if (request.done) request.done(result);
+        request.answer.set_value(result);
+    }
+    
+    void Work (void)
+    {
+        deque< unique_ptr<sessionRequest> > taken;
+        long cancelled;
+        bool stop;
+        size_t k;
+        
+        while (true)
+        {
+            {
+                unique_lock<mutex> guard(lock);
+                wake.wait(guard, [this] { return (stopping || (not waiting.empty())); });
+                taken.swap(waiting);
+                cancelled = cancelledUpTo;
+                stop = stopping;
+                interrupted = stop;
+            }
+            
+            // Make every request, then score the helix once for the newest of them.
+            short editedPep = -1; // the one peptide edited, -1 for none and -2 for several or a new helix
+            short lastEdit = -1;
+            vector<sessionResult> results(taken.size());
+            for (k=0;k<taken.size();k++)
+            {
+                sessionRequest & request = *taken[k];
+                results[k].request = request.number;
+                results[k].stale = (stop || (k+1 < taken.size()) || (request.number <= cancelled));
+                if (request.type == editRequest)
+                {
+                    results[k].applied = ((request.pep >= 0) && (request.pep < current.numPep) && (request.pos >= 0) && (request.pos < current.numAA));
+                    if (results[k].applied)
+                    {
+                        current.sequences[request.pep][request.pos] = toupper(request.aa);
+                        editedPep = ((editedPep == -1) || (editedPep == request.pep)) ? request.pep : -2;
+                        lastEdit = k;
+                    }
+                }
+                if (request.type == helixRequest)
+                {
+                    current = request.helix;
+                    editedPep = -2;
+                }
+                if (results[k].stale && (k+1 < taken.size())) Deliver(request, results[k]);
+            }
+            
+            // The sequences were changed above, so EditResidue of the last edit scores everything the edits changed.
+            if (editedPep >= 0)
+            {
+                sessionRequest & request = *taken[lastEdit];
+                EditResidue(parameters, &current, request.pep, request.pos, current.sequences[request.pep][request.pos]);
+            }
+            if (editedPep == -2)
+            {
+                current.encode();
+                ScoreHelix(parameters, &current, allOffsets);
+            }
+            
+            if (taken.size() > 0)
+            {
+                sessionRequest & request = *taken.back();
+                sessionResult & result = results.back();
+                if ((not result.stale) && (request.type == scanRequest))
+                {
+                    result.scan = MutationScan(parameters, current, &interrupted);
+                    if (interrupted)
+                    {
+                        result.stale = true;
+                        result.scan.clear();
+                    }
+                }
+                if (not result.stale) result.helix = make_shared<const TripleHelix>(current);
+                Deliver(request, result);
+            }
+            taken.clear();
+            if (stop) return;
+        }
+    }
+};
+
+// // // // // // // // // // //
+// Design search
+// // // // // // // // // // //
+// Looks for A2B / ABC designs with a higher specificity (maxTm - secondBestTm) than a starting helix by changing its
+// design positions: the Xaa and Yaa positions that hold a charged or aromatic residue (designResidues). Each of them may
+// become any of designResidues. The positions are decided one after another by a beam search. Every partial design is
+// scored with the undecided positions as they are in the starting helix, which makes each a complete design, and the
+// best of them are kept for the next position. A partial design is dropped when no way of filling its undecided
+// positions can beat the designs kept so far, going by SpecificityBound.
+const string designResidues = "DEKRFWY";
+
+// One design found by DesignSearch.
+struct designResult
+{
+    double  specificity, HighTm;
+    short   bestRegister[4];
+    string  sequences[3];
+};
+
+// A composition that includes every peptide as CCTm requires: at least one of each of an A2B helix, one of each of an ABC helix.
+bool CorrectComposition (short numPep, short a, short b, short c)
+{
+    if (numPep == 2) return (a != b) || (a != c) || (b != c);
+    if (numPep == 3) return (a != b) && (a != c) && (b != c);
+    return true;
+}
+
+// The scoring tables with the undefined amino acid (0, '@') standing for "any of designResidues": its propensities and
+// every axial and lateral value it takes part in are the largest (highest) or smallest (not highest) value that any of
+// designResidues could give there.
+scoringParameters DesignBoundParameters (const scoringParameters & parameters, bool highest)
+{
+    scoringParameters bound = parameters;
+    short x, y, i, j;
+    
+    auto pick = [highest] (double & value, double candidate, bool first)
+    {
+        if (first || (highest && (candidate > value)) || ((not highest) && (candidate < value))) value = candidate;
+    };
+    for (i=0;i<(short)designResidues.size();i++)
+    {
+        x = designResidues[i] - 64;
+        pick(bound.propensityX[0], parameters.propensityX[x], i == 0);
+        pick(bound.propensityY[0], parameters.propensityY[x], i == 0);
+        for (y=1;y<27;y++)
+        {
+            pick(bound.axial[0][y], parameters.axial[x][y], i == 0);
+            pick(bound.axial[y][0], parameters.axial[y][x], i == 0);
+            pick(bound.lateral[0][y], parameters.lateral[x][y], i == 0);
+            pick(bound.lateral[y][0], parameters.lateral[y][x], i == 0);
+        }
+        for (j=0;j<(short)designResidues.size();j++)
+        {
+            y = designResidues[j] - 64;
+            pick(bound.axial[0][0], parameters.axial[x][y], (i == 0) && (j == 0));
+            pick(bound.lateral[0][0], parameters.lateral[x][y], (i == 0) && (j == 0));
+        }
+    }
+    bound.version = NextParameterVersion();
+    return bound;
+}
+
+// An upper bound on the specificity of any design that keeps the decided residues of theHelix, whose undecided design
+// positions are '@', counting only designs whose best register is a correct composition.
+// Scores only ever go up when a propensity, axial or lateral value does, so theHelix scored with the highest and the
+// smallest stand-ins (see DesignBoundParameters) brackets the Tm of each register. The charge penalty and the Tyr/Trp
+// ends, which the stand-ins don't have, are bracketed separately. No design can then beat the highest possible Tm of
+// one of its correct registers less the highest lowest-possible Tm of any other register.
+double SpecificityBound (const scoringParameters & upper, const scoringParameters & lower, TripleHelix * theHelix)
+{
+    double high[3][3][3][9], low[3][3][3][9];
+    double upperWindows[3][3][3], lowerWindows[3][3][3];
+    short a, b, c, d, k, x, net;
+    const char ends[2] = {'Y', 'W'};
+    bool allOffsets = (theHelix->numOffsets == 9);
+    
+    auto penalty = [] (short charge) { return (abs(charge) > 6) ? (abs(charge) - 6)/3 : 0; };
+    
+    WindowPropensities(upper, theHelix, allOffsets, upperWindows);
+    WindowPropensities(lower, theHelix, allOffsets, lowerWindows);
+    for (a=0;a<theHelix->numPep;a++) for (b=0;b<theHelix->numPep;b++) for (c=0;c<theHelix->numPep;c++) for (d=0;d<theHelix->numOffsets;d++)
+    {
+        ScoreRegister(upper, theHelix, upperWindows, a, b, c, d, false);
+        high[a][b][c][d] = theHelix->Tm[a][b][c][d];
+        ScoreRegister(lower, theHelix, lowerWindows, a, b, c, d, false);
+        low[a][b][c][d] = theHelix->Tm[a][b][c][d];
+        
+        // The strands as ScoreRegister reads them.
+        short maxShift = max(offsetMidShift[d], offsetTrailShift[d]);
+        short start[3] = {maxShift, (short)(maxShift - offsetMidShift[d]), (short)(maxShift - offsetTrailShift[d])};
+        short strand[3] = {a, b, c};
+        short len = theHelix->numAA - maxShift;
+        
+        // Each undecided residue can move the net charge by one either way.
+        short undecided = 0;
+        for (k=0;k<3;k++) for (x=start[k];x<(start[k]+len);x++) if (theHelix->sequences[strand[k]][x] == '@') undecided++;
+        short counted = penalty(theHelix->netCharge[a][b][c][d]);
+        short least = counted, most = counted;
+        for (net=theHelix->netCharge[a][b][c][d]-undecided;net<=(theHelix->netCharge[a][b][c][d]+undecided);net++)
+        {
+            least = min(least, (short)penalty(net));
+            most = max(most, (short)penalty(net));
+        }
+        high[a][b][c][d] += counted - least;
+        low[a][b][c][d] -= most - counted;
+        
+        // A Tyr or Trp end not yet counted that the undecided residues could still complete.
+        for (k=0;k<2;k++) for (short last=0;last<2;last++)
+        {
+            bool possible = true, present = true;
+            for (short q=0;q<3;q++)
+            {
+                char end = theHelix->sequences[strand[q]][start[q] + last*(len-1)];
+                if (end != ends[k]) present = false;
+                if ((end != ends[k]) && (end != '@')) possible = false;
+            }
+            if (possible && (not present)) high[a][b][c][d] += 3;
+        }
+    }
+    
+    // The two highest lowest-possible Tms.
+    double firstLow = -1.0e9, secondLow = -1.0e9;
+    for (a=0;a<theHelix->numPep;a++) for (b=0;b<theHelix->numPep;b++) for (c=0;c<theHelix->numPep;c++) for (d=0;d<theHelix->numOffsets;d++)
+    {
+        if (low[a][b][c][d] >= firstLow)
+        {
+            secondLow = firstLow;
+            firstLow = low[a][b][c][d];
+        }
+        else if (low[a][b][c][d] > secondLow) secondLow = low[a][b][c][d];
+    }
+    
+    double bound = -1.0e9;
+    for (a=0;a<theHelix->numPep;a++) for (b=0;b<theHelix->numPep;b++) for (c=0;c<theHelix->numPep;c++) for (d=0;d<theHelix->numOffsets;d++)
+    {
+        if (not CorrectComposition(theHelix->numPep, a, b, c)) continue;
+        double others = firstLow;
+        if (low[a][b][c][d] == firstLow) others = secondLow;
+        bound = max(bound, high[a][b][c][d] - others);
+    }
+    return bound;
+}
+
+// Beam search over the design positions of start, which was scored with parameters (see above). beamWidth partial
+// designs are kept per position and the top best designs are returned, most specific first. Each design that enters
+// the top is handed to report as it is found. The children of a position are scored on the scoring pool.
+vector<designResult> DesignSearch (const scoringParameters & parameters, const TripleHelix & start, short beamWidth, short top, const function<void(const designResult &)> & report)
+{
+    const double unusable = -1.0e9; // the score of a design whose best register is not a correct composition
+    const double slack = 1.0e-9;    // rounding allowed for in the bounds
+    const short numResidues = designResidues.size();
+    vector<short> positionPep, positionAA;
+    vector<designResult> best;
+    vector<TripleHelix> beam(1, start);
+    short p, x, depth;
+    long k, pruned = 0;
+    
+    for (p=0;p<start.numPep;p++) for (x=0;x<start.numAA;x++)
+    {
+        if ((start.phase[x] != 2) && (designResidues.find(start.sequences[p][x]) != string::npos))
+        {
+            positionPep.push_back(p);
+            positionAA.push_back(x);
+        }
+    }
+    cout << positionPep.size() << " design positions, " << numResidues << " residues each, beam of " << beamWidth << "." << endl;
+    
+    // The bounds use their own tables, which the register cache would only be emptied for.
+    bool cacheWasEnabled = scoreCache.enabled;
+    scoreCache.enabled = false;
+    scoringParameters upper = DesignBoundParameters(parameters, true);
+    scoringParameters lower = DesignBoundParameters(parameters, false);
+    
+    auto score = [&] (const TripleHelix & theHelix)
+    {
+        if (CorrectComposition(theHelix.numPep, theHelix.bestRegister[0], theHelix.bestRegister[1], theHelix.bestRegister[2])) return theHelix.specificity;
+        return unusable;
+    };
+    auto offer = [&] (const TripleHelix & theHelix, double specificity)
+    {
+        if ((specificity <= unusable) || ((short)best.size() >= top && (specificity <= best.back().specificity))) return;
+        designResult design;
+        design.specificity = specificity;
+        design.HighTm = theHelix.HighTm;
+        for (short r=0;r<4;r++) design.bestRegister[r] = theHelix.bestRegister[r];
+        for (short q=0;q<theHelix.numPep;q++) design.sequences[q] = string(theHelix.sequences[q], theHelix.numAA);
+        auto place = best.begin();
+        while ((place != best.end()) && (place->specificity >= specificity)) place++;
+        best.insert(place, design);
+        if ((short)best.size() > top) best.pop_back();
+        report(design);
+    };
+    offer(start, score(start));
+    
+    for (depth=0;depth<(short)positionPep.size();depth++)
+    {
+        short pep = positionPep[depth], pos = positionAA[depth];
+        long numChildren = beam.size() * numResidues;
+        vector<TripleHelix> children(numChildren);
+        vector<double> childScore(numChildren), childBound(numChildren);
+        
+        ScoringPool().Run(numChildren, [&] (long item)
+        {
+            TripleHelix & child = children[item];
+            child = beam[item / numResidues];
+            if (child.sequences[pep][pos] != designResidues[item % numResidues]) EditResidue(parameters, &child, pep, pos, designResidues[item % numResidues]);
+            childScore[item] = score(child);
+            
+            TripleHelix undecided = child;
+            for (short later=depth+1;later<(short)positionPep.size();later++) undecided.sequences[positionPep[later]][positionAA[later]] = '@';
+            undecided.encode();
+            childBound[item] = SpecificityBound(upper, lower, &undecided);
+        });
+        
+        // A child that keeps the residue of its parent is the parent, which was offered already.
+        for (k=0;k<numChildren;k++) if (children[k].sequences[pep][pos] != beam[k / numResidues].sequences[pep][pos]) offer(children[k], childScore[k]);
+        
+        vector<long> order;
+        for (k=0;k<numChildren;k++)
+        {
+            if (((short)best.size() >= top) && (childBound[k] < (best.back().specificity - slack))) pruned++;
+            else order.push_back(k);
+        }
+        stable_sort(order.begin(), order.end(), [&] (long first, long second)
+        {
+            if (childScore[first] != childScore[second]) return childScore[first] > childScore[second];
+            return childBound[first] > childBound[second];
+        });
+        if ((short)order.size() > beamWidth) order.resize(beamWidth);
+        
+        beam.clear();
+        for (long item : order) beam.push_back(children[item]);
+        cout << "Position " << depth+1 << " of " << positionPep.size() << " (peptide " << pep << " #" << pos << "): " << beam.size() << " kept, " << pruned << " pruned so far";
+        if (best.size() > 0) cout << ". Best specificity = " << best[0].specificity;
+        cout << endl;
+        if (beam.size() == 0) break;
+    }
+    
+    scoreCache.enabled = cacheWasEnabled;
+    return best;
+}
+
+void PrintDesign (const designResult & design, short numPep)
+{
+    cout << "Specificity = " << design.specificity << "\tTm = " << design.HighTm;
+    cout << "\t{" << design.bestRegister[0] << design.bestRegister[1] << design.bestRegister[2] << "}";
+    if (design.bestRegister[3] != 0) cout << " " << offsetName[design.bestRegister[3]];
+    for (short p=0;p<numPep;p++) cout << "\t" << design.sequences[p];
+    cout << endl;
+}
+
+// Inverted index from each scoring parameter to the helices (by library number) whose score can depend on it.
+// Used by the optimizer so a trial change to one parameter only rescores the helices that use it.
+struct libraryIndexType
+{
+    vector<short> propensityX[27];
+    vector<short> propensityY[27];
+    vector<short> axial[27][27];
+    vector<short> lateral[27][27];
+};
+
+// Counts all Xaa, Yaa and pairwise interactions possible in canonical registers for this library.
+// If index is given it is filled during the same walk. The index follows the bounds used by ScoreHelix and,
+// when allOffsets is set, the pairs the staggered strands bring together, so it may list a few helices that
+// turn out not to use a parameter but never misses one that does.
+void CountInteractions (HelixLibrary & Lib, short TotalHelices, parameterType & countInteractions, libraryIndexType * index, bool allOffsets)
+{
+    short n, a, b, c, x, y, k, j;
+    short numShifts = 1;
+    const short strandShift[5] = {0, -3, 3, -6, 6}; // start of the second strand of a thread relative to the first
+    bool usesPropX[27], usesPropY[27], usesAxial[27][27], usesLateral[27][27];
+    
+    if (allOffsets) numShifts = 5;
+    
+    // Zero interactions
+    for (y=0;y<27;y++)
+    {
+        countInteractions.propensityX[y] = 0;
+        countInteractions.propensityY[y] = 0;
+        for (x=0;x<27;x++)
+        {
+            countInteractions.lateral[y][x] = 0;
+            countInteractions.axial[y][x] = 0;
+        }
+    }
+    if (index != NULL)
+    {
+        for (y=0;y<27;y++)
+        {
+            index->propensityX[y].clear();
+            index->propensityY[y].clear();
+            for (x=0;x<27;x++)
+            {
+                index->axial[y][x].clear();
+                index->lateral[y][x].clear();
+            }
+        }
+    }
+    
+    // Count interactions
+    for (n=0; n<TotalHelices; n++) // doesn't look at the user's helix.
+    {
+        for (y=0;y<27;y++)
+        {
+            usesPropX[y] = false;
+            usesPropY[y] = false;
+            for (x=0;x<27;x++)
+            {
+                usesAxial[y][x] = false;
+                usesLateral[y][x] = false;
+            }
+        }
+        
+        for (a=0;a<Lib[n].numPep;a++)
+        {
+            for (x=0;x<Lib[n].numAA;x++)
+            {
+                if (Lib[n].isXaa(x)) countInteractions.propensityX[short(Lib[n].sequences[a][x])-64]++;
+                if (Lib[n].isYaa(x)) countInteractions.propensityY[short(Lib[n].sequences[a][x])-64]++;
+                if (Lib[n].isXaa(x)) usesPropX[short(Lib[n].sequences[a][x])-64] = true;
+                if (Lib[n].isYaa(x)) usesPropY[short(Lib[n].sequences[a][x])-64] = true;
+            }
+            for (b=0;b<Lib[n].numPep;b++)for (c=0;c<Lib[n].numPep;c++)
+            {
+                for (x=0;x<Lib[n].numAA;x++)
+                {
+                    if (Lib[n].isYaa(x))
+                    {
+                        if ((x+2) < Lib[n].numAA) countInteractions.axial[short(Lib[n].sequences[a][x])-64][short(Lib[n].sequences[b][x+2])-64]++;
+                        if ((x+2) < Lib[n].numAA) countInteractions.axial[short(Lib[n].sequences[b][x])-64][short(Lib[n].sequences[c][x+2])-64]++;
+                        if ((x+5) < Lib[n].numAA) countInteractions.axial[short(Lib[n].sequences[c][x])-64][short(Lib[n].sequences[a][x+5])-64]++;
+                    
+                        if (x>1) countInteractions.lateral[short(Lib[n].sequences[a][x])-64][short(Lib[n].sequences[b][x-1])-64]++;
+                        if (x>1) countInteractions.lateral[short(Lib[n].sequences[b][x])-64][short(Lib[n].sequences[c][x-1])-64]++;
+                        if ((x+2) < Lib[n].numAA) countInteractions.lateral[short(Lib[n].sequences[c][x])-64][short(Lib[n].sequences[a][x+2])-64]++;
+                    }
+                }
+            }
+            
+            // Every thread pairs a Yaa of one peptide with residues further along another (or the same) peptide:
+            // axial +2 and lateral -1 for the first and second threads, axial +5 and lateral +2 for the third.
+            if (index == NULL) continue;
+            for (b=0;b<Lib[n].numPep;b++) for (x=0;x<Lib[n].numAA;x++) if (Lib[n].isYaa(x)) for (k=0;k<numShifts;k++)
+            {
+                j = x + strandShift[k] + 2;
+                if ((j >= 0) && (j < Lib[n].numAA)) usesAxial[short(Lib[n].sequences[a][x])-64][short(Lib[n].sequences[b][j])-64] = true;
+                j = x + strandShift[k] + 5;
+                if ((j >= 0) && (j < Lib[n].numAA)) usesAxial[short(Lib[n].sequences[a][x])-64][short(Lib[n].sequences[b][j])-64] = true;
+                j = x + strandShift[k] - 1;
+                if ((j >= 0) && (j < Lib[n].numAA)) usesLateral[short(Lib[n].sequences[a][x])-64][short(Lib[n].sequences[b][j])-64] = true;
+                j = x + strandShift[k] + 2;
+                if ((j >= 0) && (j < Lib[n].numAA)) usesLateral[short(Lib[n].sequences[a][x])-64][short(Lib[n].sequences[b][j])-64] = true;
+            }
+        }
+        
+        if (index == NULL) continue;
+        for (y=0;y<27;y++)
+        {
+            if (usesPropX[y]) index->propensityX[y].push_back(n);
+            if (usesPropY[y]) index->propensityY[y].push_back(n);
+            for (x=0;x<27;x++)
+            {
+                if (usesAxial[y][x]) index->axial[y][x].push_back(n);
+                if (usesLateral[y][x]) index->lateral[y][x].push_back(n);
+            }
+        }
+    }
+}
+
+// // // // // // // // // // //
+// Low confidence interactions
+// // // // // // // // // // //
+// An axial or lateral pair seen fewer than lowConfidenceCut times in the training library is poorly modeled (0-25
+// counts poorly, 26-50 moderately and 51+ well). The counts are kept sparse, one interactionCount for each pair (and
+// each Xaa and Yaa propensity) the library has at all, in key order. A helix is checked by looking up only the pairs
+// it has, so checking is cheap enough for every record of options (2) and (9), and once option (4) has written the
+// counts (WriteInteractionCounts) the training library needn't be read for them.
+const long lowConfidenceCut = 25;
+
+enum interactionKind { axialInteraction, lateralInteraction, propensityXCount, propensityYCount };
+
+struct interactionCount
+{
+    unsigned int    key;    // kind*729 + first*27 + second, with first 0 for the propensities
+    unsigned int    count;
+};
+
+struct interactionIndex
+{
+    vector<interactionCount> counts;
+    
+    static unsigned int key(short kind, short first, short second)
+    {
+        return kind*729 + first*27 + second;
+    };
+    
+    // How often the training library has this interaction, 0 if never.
+    long count(unsigned int theKey) const
+    {
+        auto found = lower_bound(counts.begin(), counts.end(), theKey, [] (const interactionCount & entry, unsigned int k) { return entry.key < k; });
+        if ((found == counts.end()) || (found->key != theKey)) return 0;
+        return found->count;
+    };
+};
+
+// Keeps the interactions countInteractions (from CountInteractions) has at least once.
+void IndexInteractions (const parameterType & countInteractions, interactionIndex & index)
+{
+    short x, y;
+    
+    index.counts.clear();
+    for (y=0;y<27;y++) for (x=0;x<27;x++) if (countInteractions.axial[y][x] > 0) index.counts.push_back({interactionIndex::key(axialInteraction, y, x), (unsigned int)countInteractions.axial[y][x]});
+    for (y=0;y<27;y++) for (x=0;x<27;x++) if (countInteractions.lateral[y][x] > 0) index.counts.push_back({interactionIndex::key(lateralInteraction, y, x), (unsigned int)countInteractions.lateral[y][x]});
+    for (x=0;x<27;x++) if (countInteractions.propensityX[x] > 0) index.counts.push_back({interactionIndex::key(propensityXCount, 0, x), (unsigned int)countInteractions.propensityX[x]});
+    for (x=0;x<27;x++) if (countInteractions.propensityY[x] > 0) index.counts.push_back({interactionIndex::key(propensityYCount, 0, x), (unsigned int)countInteractions.propensityY[x]});
+}
+
+// The low confidence interactions of a helix, each key with the number of times the helix has it, in key order.
+struct lowConfidenceList
+{
+    long                                total = 0;
+    vector< pair<unsigned int, long> >  pairs;
+};
+
+// Every axial and lateral pair possible in the canonical registers / compositions of theHelix, as CountInteractions
+// counts them, that the training library has fewer than cut of.
+lowConfidenceList LowConfidence (const TripleHelix & theHelix, const interactionIndex & index, long cut = lowConfidenceCut)
+{
+    lowConfidenceList poor;
+    vector<unsigned int> seen;
+    short a, b, c, x;
+    size_t k, run;
+    
+    auto pairOf = [&] (short kind, short p, short i, short q, short j)
+    {
+        seen.push_back(interactionIndex::key(kind, short(theHelix.sequences[p][i])-64, short(theHelix.sequences[q][j])-64));
+    };
+    for (a=0;a<theHelix.numPep;a++) for (b=0;b<theHelix.numPep;b++) for (c=0;c<theHelix.numPep;c++)
+    {
+        for (x=0;x<theHelix.numAA;x++)
+        {
+            if (not theHelix.isYaa(x)) continue;
+            if ((x+2) < theHelix.numAA) pairOf(axialInteraction, a, x, b, x+2);
+            if ((x+2) < theHelix.numAA) pairOf(axialInteraction, b, x, c, x+2);
+            if ((x+5) < theHelix.numAA) pairOf(axialInteraction, c, x, a, x+5);
+            if (x>1) pairOf(lateralInteraction, a, x, b, x-1);
+            if (x>1) pairOf(lateralInteraction, b, x, c, x-1);
+            if ((x+2) < theHelix.numAA) pairOf(lateralInteraction, c, x, a, x+2);
+        }
+    }
+    
+    // Each distinct pair is looked up once.
+    sort(seen.begin(), seen.end());
+    for (k=0;k<seen.size();k+=run)
+    {
+        for (run=1;((k+run) < seen.size()) && (seen[k+run] == seen[k]);run++);
+        if (index.count(seen[k]) >= cut) continue;
+        poor.pairs.push_back(make_pair(seen[k], (long)run));
+        poor.total += run;
+    }
+    return poor;
+}
+
+// Everything an optimizer trial needs besides the parameter being changed.
+struct optimizerState
+{
+    HelixLibrary *  Lib;
+    short           TotalHelices;
+    double          delta;
+    double          maxDev;
+    bool            allOffsets;
+    bool            quiet;              // don't show each change, e.g. for fits run side by side
+    
+    double          sumSquaredDev;      // of the accepted parameters
+    vector<double>  acceptedDeviation;  // deviation of each helix under the accepted parameters
+    long            trials;
+    long            helicesRescored;
+};
+
+// Rescores the helices in affected and returns how much the library's sum of squared deviations changes
+// relative to the accepted parameters. Helices not in affected cannot have changed.
+double RescoreAffected (const scoringParameters & parameters, optimizerState & opt, const vector<short> & affected)
+{
+    double changeSSD = 0;
+    short k, n;
+    
+    PROFILE_SPAN(profileOptimizerTrial, affected.size());
+    ScoreEntries(parameters, *opt.Lib, affected, opt.allOffsets);
+    // Summed in index order so the result does not depend on how the pool split the work.
+    for (k=0;k<(short)affected.size();k++)
+    {
+        n = affected[k];
+        changeSSD += ((*opt.Lib)[n].deviation * (*opt.Lib)[n].deviation) - (opt.acceptedDeviation[n] * opt.acceptedDeviation[n]);
+    }
+    opt.trials++;
+    opt.helicesRescored += affected.size();
+    return changeSSD;
+}
+
+// One coordinate-descent step for a single parameter (value, which lives inside parameters).
+// Tries value - delta and then value + delta, staying within maxDev of the experimental value.
+// Keeps the first change that lowers the sum of squared deviations, otherwise restores value.
+// Only the helices in affected are rescored and the sum of squared deviations is patched rather than rebuilt.
+// Changes smaller than minImprovement are rounding noise (e.g. a stabilizing entry that is never chosen) and are not kept.
+// Returns true if the parameter was changed.
+const double minImprovement = 1.0e-9;
+
+bool OptimizeOneParameter (parameterType & parameters, double & value, double experimental, const vector<short> & affected, string name, optimizerState & opt)
+{
+    double changeSSD;
+    short k;
+    
+    if (affected.size() == 0) return false; // nothing in the library uses this parameter.
+    
+    value -= opt.delta;
+    parameters.version = NextParameterVersion();
+    if (value >= (experimental - opt.maxDev)) // Only test this optimization if we are in range (2) of experimental values.
+    {
+        changeSSD = RescoreAffected(parameters, opt, affected);
+        if (changeSSD < -minImprovement)
+        {
+            // keep this new parameter and move on.
+            opt.sumSquaredDev += changeSSD;
+            for (k=0;k<(short)affected.size();k++) opt.acceptedDeviation[affected[k]] = (*opt.Lib)[affected[k]].deviation;
+            if (not opt.quiet) cout << name << " adjusted to " << value << ". New SSDev = " << opt.sumSquaredDev << endl;
+            return true;
+        }
+    }
+    
+    value += 2*opt.delta;
+    parameters.version = NextParameterVersion();
+    if (value <= (experimental + opt.maxDev)) // Only test this optimization if we are in range (2) of experimental values.
+    {
+        changeSSD = RescoreAffected(parameters, opt, affected);
+        if (changeSSD < -minImprovement)
+        {
+            opt.sumSquaredDev += changeSSD;
+            for (k=0;k<(short)affected.size();k++) opt.acceptedDeviation[affected[k]] = (*opt.Lib)[affected[k]].deviation;
+            if (not opt.quiet) cout << name << " adjusted to " << value << ". New SSDev = " << opt.sumSquaredDev << endl;
+            return true;
+        }
+    }
+    
+    // neither change resulted in an improvement. Go back to original parameter and put the helices back the way they were.
+    value -= opt.delta;
+    parameters.version = NextParameterVersion();
+    RescoreAffected(parameters, opt, affected);
+    return false;
+}
+
+// A trial value of one parameter for the parallel line search. kind is 0-3 for propensityX[x], propensityY[x], axial[x][y] and lateral[x][y].
+struct searchCandidate
+{
+    short                   kind, x, y;
+    double                  trialValue;
+    const vector<short> *   affected;
+    string                  name;
+    double                  changeSSD;
+};
+
+double & ParameterValue (scoringParameters & parameters, short kind, short x, short y)
+{
+    if (kind == 0) return parameters.propensityX[x];
+    if (kind == 1) return parameters.propensityY[x];
+    if (kind == 2) return parameters.axial[x][y];
+    return parameters.lateral[x][y];
+}
+
+// Adds value - delta and value + delta as candidates, where they stay within maxDev of the experimental value (as OptimizeOneParameter would try them).
+void AddCandidates (parameterType & parameters, short kind, short x, short y, double experimental, const vector<short> & affected, string name, const optimizerState & opt, vector<searchCandidate> & candidates)
+{
+    double value = ParameterValue(parameters, kind, x, y);
+    
+    if (affected.size() == 0) return; // nothing in the library uses this parameter.
+    if ((value - opt.delta) >= (experimental - opt.maxDev)) candidates.push_back({kind, x, y, value - opt.delta, &affected, name, 0});
+    if ((value + opt.delta) <= (experimental + opt.maxDev)) candidates.push_back({kind, x, y, value + opt.delta, &affected, name, 0});
+}
+
+// One round of the parallel line search. Every candidate is scored at once on the pool, each with its own copy of
+// the parameters and of the helices it affects, so the library itself is untouched while they are scored. The largest
+// improvements are kept as long as their affected helices don't overlap; for those the changes they were scored with
+// still add up exactly. Improvements that overlapped a kept one are scored again against the changed library, and so
+// on until none are left, so that (as in the one-at-a-time search) each parameter can move once per round.
+// Returns the number of parameters changed.
+short ParallelSearchRound (parameterType & parameters, vector<searchCandidate> & candidates, optimizerState & opt)
+{
+    long k, j;
+    short kept = 0;
+    vector<long> pending(candidates.size());
+    vector<bool> moved(candidates.size(), false); // this candidate's parameter has already changed this round
+    
+    for (k=0;k<(long)candidates.size();k++) pending[k] = k;
+    
+    while (pending.size() > 0)
+    {
+        ScoringPool().Run(pending.size(), [&] (long item)
+        {
+            searchCandidate & trial = candidates[pending[item]];
+            PROFILE_SPAN(profileOptimizerTrial, trial.affected->size());
+            scoringParameters trialParameters = parameters;
+            TripleHelix scratch;
+            ParameterValue(trialParameters, trial.kind, trial.x, trial.y) = trial.trialValue;
+            trialParameters.version = NextParameterVersion();
+            
+            // Summed in index order, as RescoreAffected does.
+            trial.changeSSD = 0;
+            for (short n : *trial.affected)
+            {
+                scratch = (*opt.Lib)[n];
+                ScoreHelix(trialParameters, &scratch, opt.allOffsets);
+                trial.changeSSD += (scratch.deviation * scratch.deviation) - (opt.acceptedDeviation[n] * opt.acceptedDeviation[n]);
+            }
+        });
+        
+        vector<long> improving;
+        for (long item : pending)
+        {
+            opt.trials++;
+            opt.helicesRescored += candidates[item].affected->size();
+            if (candidates[item].changeSSD < -minImprovement) improving.push_back(item);
+        }
+        stable_sort(improving.begin(), improving.end(), [&] (long first, long second) { return candidates[first].changeSSD < candidates[second].changeSSD; });
+        
+        vector<bool> touched(opt.TotalHelices, false);
+        vector<short> changed;
+        pending.clear();
+        for (long item : improving)
+        {
+            searchCandidate & trial = candidates[item];
+            if (moved[item]) continue;
+            bool overlaps = false;
+            for (j=0;(j<(long)trial.affected->size()) && (not overlaps);j++) if (touched[(*trial.affected)[j]]) overlaps = true;
+            if (overlaps)
+            {
+                pending.push_back(item);
+                continue;
+            }
+            
+            for (short n : *trial.affected)
+            {
+                touched[n] = true;
+                changed.push_back(n);
+            }
+            ParameterValue(parameters, trial.kind, trial.x, trial.y) = trial.trialValue;
+            parameters.version = NextParameterVersion();
+            opt.sumSquaredDev += trial.changeSSD;
+            kept++;
+            if (not opt.quiet) cout << trial.name << " adjusted to " << trial.trialValue << ". New SSDev = " << opt.sumSquaredDev << endl;
+            
+            // The other direction of the same parameter is done with for this round.
+            for (k=0;k<(long)candidates.size();k++) if ((candidates[k].kind == trial.kind) && (candidates[k].x == trial.x) && (candidates[k].y == trial.y)) moved[k] = true;
+        }
+        
+        // Bring the library up to the kept parameters, then drop anything left whose parameter has moved.
+        ScoreEntries(parameters, *opt.Lib, changed, opt.allOffsets);
+        for (short n : changed) opt.acceptedDeviation[n] = (*opt.Lib)[n].deviation;
+        for (k=(long)pending.size()-1;k>=0;k--) if (moved[pending[k]]) pending.erase(pending.begin()+k);
+    }
+    return kept;
+}
+
+// One round of the optimizer over every parameter marked for optimization: ParallelSearchRound if parallelSearch,
+// otherwise OptimizeOneParameter on each in turn. Returns true if any parameter was changed.
+bool OptimizerRound (parameterType & parameters, const libraryIndexType & libraryIndex, optimizerState & opt, bool parallelSearch)
+{
+    bool improved = false;
+    short x, y;
+    
+    if (parallelSearch)
+    {
+        vector<searchCandidate> candidates;
+        for (x=0;x<27;x++)
+        {
+            if (parameters.optPropX[x]) AddCandidates(parameters, 0, x, 0, parameters.exPropensityX[x], libraryIndex.propensityX[x], string("Xaa") + char(x+64), opt, candidates);
+            if (parameters.optPropY[x]) AddCandidates(parameters, 1, x, 0, parameters.exPropensityY[x], libraryIndex.propensityY[x], string("Yaa") + char(x+64), opt, candidates);
+            for (y=0;y<27;y++)
+            {
+                if (parameters.optAxial[x][y]) AddCandidates(parameters, 2, x, y, parameters.exAxial[x][y], libraryIndex.axial[x][y], string("axial") + char(x+64) + "," + char(y+64), opt, candidates);
+                if (parameters.optLat[x][y]) AddCandidates(parameters, 3, x, y, parameters.exLateral[x][y], libraryIndex.lateral[x][y], string("lateral") + char(x+64) + "," + char(y+64), opt, candidates);
+            }
+        }
+        if (ParallelSearchRound(parameters, candidates, opt) > 0) improved = true;
+    }
+    else for (x=0;x<27;x++)
+    {
+        if (parameters.optPropX[x])
+        {
+            if (OptimizeOneParameter(parameters, parameters.propensityX[x], parameters.exPropensityX[x], libraryIndex.propensityX[x], string("Xaa") + char(x+64), opt)) improved = true;
+        }
+        
+        if (parameters.optPropY[x])
+        {
+            if (OptimizeOneParameter(parameters, parameters.propensityY[x], parameters.exPropensityY[x], libraryIndex.propensityY[x], string("Yaa") + char(x+64), opt)) improved = true;
+        }
+        
+        for (y=0;y<27;y++)
+        {
+            if (parameters.optAxial[x][y])
+            {
+                if (OptimizeOneParameter(parameters, parameters.axial[x][y], parameters.exAxial[x][y], libraryIndex.axial[x][y], string("axial") + char(x+64) + "," + char(y+64), opt)) improved = true;
+            }
+            
+            if (parameters.optLat[x][y])
+            {
+                if (OptimizeOneParameter(parameters, parameters.lateral[x][y], parameters.exLateral[x][y], libraryIndex.lateral[x][y], string("lateral") + char(x+64) + "," + char(y+64), opt)) improved = true;
+            }
+        }
+    }
+    return improved;
+}
+
+// Runs the coordinate descent of option (0) on opt.Lib, round after round of OptimizerRound, until a round changes
+// nothing or after maxRounds rounds. Returns the number of rounds; opt.sumSquaredDev is left rebuilt for the fitted
+// parameters. Unless opt.quiet each change and each round is shown.
+short FitParameters (parameterType & parameters, const libraryIndexType & libraryIndex, optimizerState & opt, short maxRounds, bool parallelSearch)
+{
+    bool done = false;
+    bool improvedRound = false;
+    short round = 0;
+    short n;
     
-    // NOTE: d loop is being short circuited to only look at canonical registers here! //
-    for (a=0; a<theHelix->numPep; a++) for (b=0; b<theHelix->numPep; b++) for (c=0; c<theHelix->numPep; c++) for (d=0;d<1;d++)
+    while (not done)
     {
-        // // // // // // // //
-        // Offset Switch       //
-        // // // // // // // //
-        trimmedHelix.numPep = theHelix->numPep;
-        trimmedHelix.Nterm = theHelix->Nterm;
-        trimmedHelix.Cterm = theHelix->Cterm;
-        trimmedHelix.XaaPos = theHelix->XaaPos;
-        // Trim triple helix for offset scoring.
-        switch(d)
-        {
-            case 0:
-                // 0 is {012}, canonical and therefore needs no trimming.
-                // Still need to move thisHelix into trimmedHelix for scoring below
-                for(y=0;y<theHelix->numAA;y++) trimmedHelix.sequences[a][y] = theHelix->sequences[a][y];
-                for(y=0;y<theHelix->numAA;y++) trimmedHelix.sequences[b][y] = theHelix->sequences[b][y];
-                for(y=0;y<theHelix->numAA;y++) trimmedHelix.sequences[c][y] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA;
-                break;
-                
-            case 1:
-                // 1 is {015}
-                // trailing strand is offset 3 and therefore needs to be cut at C term while leading and middle strands need to lose first triplet
-                for(y=3;y<theHelix->numAA;y++) trimmedHelix.sequences[a][y-3] = theHelix->sequences[a][y];
-                for(y=3;y<theHelix->numAA;y++) trimmedHelix.sequences[b][y-3] = theHelix->sequences[b][y];
-                for(y=0;y<theHelix->numAA-3;y++) trimmedHelix.sequences[c][y] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA - 3;
-                break;
-
-            case 2:
-                // 3 is {042}
-                // middle strand is offset 3, others are not shifted. Cut lead and trail at N-term, mid at C term
-                for(y=3;y<theHelix->numAA-0;y++) trimmedHelix.sequences[a][y-3] = theHelix->sequences[a][y];
-                for(y=0;y<theHelix->numAA-3;y++) trimmedHelix.sequences[b][y-0] = theHelix->sequences[b][y];
-                for(y=3;y<theHelix->numAA-0;y++) trimmedHelix.sequences[c][y-3] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA - 3;
-                break;
-                
-            case 3:
-                // 4 is {045}
-                // mid and trail are offset 3. Cut lead at N-term, mid and trail at C term
-                for(y=3;y<theHelix->numAA-0;y++) trimmedHelix.sequences[a][y-3] = theHelix->sequences[a][y];
-                for(y=0;y<theHelix->numAA-3;y++) trimmedHelix.sequences[b][y-0] = theHelix->sequences[b][y];
-                for(y=0;y<theHelix->numAA-3;y++) trimmedHelix.sequences[c][y-0] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA - 3;
-                break;
-                
-            case 4:
-                // 2 is {018}
-                for(y=6;y<theHelix->numAA;y++) trimmedHelix.sequences[a][y-6] = theHelix->sequences[a][y];
-                for(y=6;y<theHelix->numAA;y++) trimmedHelix.sequences[b][y-6] = theHelix->sequences[b][y];
-                for(y=0;y<theHelix->numAA-6;y++) trimmedHelix.sequences[c][y] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA - 6;
-                break;
-                
-            case 5:
-                // 5 is {048}
-                // mid by 3, trail by 6.
-                for(y=6;y<theHelix->numAA-0;y++) trimmedHelix.sequences[a][y-6] = theHelix->sequences[a][y];
-                for(y=3;y<theHelix->numAA-3;y++) trimmedHelix.sequences[b][y-3] = theHelix->sequences[b][y];
-                for(y=0;y<theHelix->numAA-6;y++) trimmedHelix.sequences[c][y-0] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA - 6;
-                break;
-            case 6:
-                // 6 is {072}
-                // mid by 6, trail by 3
-                for(y=6;y<theHelix->numAA-0;y++) trimmedHelix.sequences[a][y-6] = theHelix->sequences[a][y];
-                for(y=0;y<theHelix->numAA-6;y++) trimmedHelix.sequences[b][y-0] = theHelix->sequences[b][y];
-                for(y=3;y<theHelix->numAA-6;y++) trimmedHelix.sequences[c][y-3] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA - 6;
-                break;
-            case 7:
-                // 7 is {075}
-                // mid by 6, trail by 3
-                for(y=6;y<theHelix->numAA-0;y++) trimmedHelix.sequences[a][y-6] = theHelix->sequences[a][y];
-                for(y=0;y<theHelix->numAA-6;y++) trimmedHelix.sequences[b][y-0] = theHelix->sequences[b][y];
-                for(y=3;y<theHelix->numAA-3;y++) trimmedHelix.sequences[c][y-3] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA - 6;
-                break;
-            case 8:
-                // 8 is {078}
-                // mid by 6, trail by 6
-                for(y=6;y<theHelix->numAA-0;y++) trimmedHelix.sequences[a][y-6] = theHelix->sequences[a][y];
-                for(y=0;y<theHelix->numAA-6;y++) trimmedHelix.sequences[b][y-0] = theHelix->sequences[b][y];
-                for(y=0;y<theHelix->numAA-6;y++) trimmedHelix.sequences[c][y-0] = theHelix->sequences[c][y];
-                trimmedHelix.numAA = theHelix->numAA - 6;
-                break;
-            default:
-                cout << "Value of d out of bounds. d = " << d << endl;
-                break;
-                
+    // // // // // // // //
+    // Now optimize parameters where possible.
+    // // // // // // // //
+    {
+    // LENGTH PARAMETERS //
+    /* for now, don't try to optimize these since we don't have a lot of different sized peptides in our library. Mostly just 24 & 30 aa peptides.
+        // // //
+        // A  //
+        // // //
+        parameters.A -= 0.01;
+        NewSumSquaredDev = 0;
+        for (n=0; n<TotalHelices; n++)
+        {
+            Library[n] = ScoreHelix (parameters, Library[n]);
+            NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
+        }
+        if (NewSumSquaredDev < sumSquaredDev)
+        {
+            // keep this new parameter and move on.
+            cout << "A-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
+            sumSquaredDev = NewSumSquaredDev;
+            improved = true;
+        }
+        else
+        {
+            parameters.A += 0.02;
+            NewSumSquaredDev = 0;
+            for (n=0; n<TotalHelices; n++)
+            {
+                Library[n] = ScoreHelix (parameters, Library[n]);
+                NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
+            }
+            if (NewSumSquaredDev < sumSquaredDev)
+            {
+                // keep this new parameter and move on.
+                cout << "A-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
+                sumSquaredDev = NewSumSquaredDev;
+                improved = true;
+            }
+            else
+            {
+                // neither change resulted in an improvement. Go back to original parameter.
+                parameters.A -= 0.01;
+            }
+        }
+        
+        // // //
+        // B  //
+        // // //
+        parameters.B -= 0.002;
+        NewSumSquaredDev = 0;
+        for (n=0; n<TotalHelices; n++)
+        {
+            Library[n] = ScoreHelix (parameters, Library[n]);
+            NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
+        }
+        if (NewSumSquaredDev < sumSquaredDev)
+        {
+            // keep this new parameter and move on.
+            cout << "B-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
+            sumSquaredDev = NewSumSquaredDev;
+            improved = true;
+        }
+        else
+        {
+            parameters.B += 0.004;
+            NewSumSquaredDev = 0;
+            for (n=0; n<TotalHelices; n++)
+            {
+                Library[n] = ScoreHelix (parameters, Library[n]);
+                NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
+            }
+            if (NewSumSquaredDev < sumSquaredDev)
+            {
+                // keep this new parameter and move on.
+                cout << "B-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
+                sumSquaredDev = NewSumSquaredDev;
+                improved = true;
+            }
+            else
+            {
+                // neither change resulted in an improvement. Go back to original parameter.
+                parameters.B -= 0.002;
+            }
         }
         
-        // // // // //
-        // Length   //
-        // // // // //
-        if (trimmedHelix.numAA >50)
+        // // //
+        // C  //
+        // // //
+        parameters.C -= 0.0002;
+        NewSumSquaredDev = 0;
+        for (n=0; n<TotalHelices; n++)
+        {
+            Library[n] = ScoreHelix (parameters, Library[n]);
+            NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
+        }
+        if (NewSumSquaredDev < sumSquaredDev)
         {
-            lengthBasis = parameters.A + (parameters.B*50) + (parameters.C*50*50);
+            // keep this new parameter and move on.
+            cout << "C-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
+            sumSquaredDev = NewSumSquaredDev;
+            improved = true;
         }
         else
         {
-            if (d == 0) lengthBasis = parameters.A + (parameters.B*trimmedHelix.numAA) + (parameters.C*trimmedHelix.numAA*trimmedHelix.numAA);
-            if ((d == 1) || (d == 2) || (d == 3)) lengthBasis = parameters.A + (parameters.B*(trimmedHelix.numAA+1)) + (parameters.C*(trimmedHelix.numAA+1)*(trimmedHelix.numAA+1));
+            parameters.C += 0.0004;
+            NewSumSquaredDev = 0;
+            for (n=0; n<TotalHelices; n++)
+            {
+                Library[n] = ScoreHelix (parameters, Library[n]);
+                NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
+            }
+            if (NewSumSquaredDev < sumSquaredDev)
+            {
+                // keep this new parameter and move on.
+                cout << "C-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
+                sumSquaredDev = NewSumSquaredDev;
+                improved = true;
+            }
+            else
+            {
+                // neither change resulted in an improvement. Go back to original parameter.
+                parameters.C -= 0.0002;
+            }
         }
-        //cout << "lengthBasis = " << lengthBasis << endl;
-        theHelix->Propensity[a][b][c][d] = lengthBasis;
+        */
+    } // hidden length optimization which we are not doing at the moment.
+    
+    if (OptimizerRound(parameters, libraryIndex, opt, parallelSearch)) improvedRound = true;
         
-        // // // // // //
-        // TERMINATION //
-        // // // // // //
-        if (trimmedHelix.Nterm == "n") theHelix->Propensity[a][b][c][d] -= 1.8;
-        if (trimmedHelix.Cterm == "c") theHelix->Propensity[a][b][c][d] -= 1.8;
+        // Rebuild the sum from the accepted deviations so patching does not accumulate rounding.
+        opt.sumSquaredDev = 0;
+        for (n=0; n<opt.TotalHelices; n++) opt.sumSquaredDev += (opt.acceptedDeviation[n] * opt.acceptedDeviation[n]);
         
-        // // // // // // // // //
-        // Tyrosine/Tryptophan Termination //
-        // // // // // // // // //
-        if ((trimmedHelix.sequences[a][0] == 'Y') && (trimmedHelix.sequences[b][0] == 'Y') && (trimmedHelix.sequences[c][0] == 'Y'))
+        if (not improvedRound) done = true;
+        improvedRound = false;
+        round++;
+        if (round >= maxRounds) done = true;
+        if (not opt.quiet)
         {
-            theHelix->Propensity[a][b][c][d] += 3;
+            cout << "End round #" << round << ". Avg of SSDev = " << opt.sumSquaredDev / opt.TotalHelices << endl;
+            cout << opt.trials << " trials rescored " << opt.helicesRescored << " helices (" << double(opt.helicesRescored) / opt.TotalHelices << " library passes)." << endl << endl;
         }
-        if ((trimmedHelix.sequences[a][trimmedHelix.numAA-1] == 'Y') && (trimmedHelix.sequences[b][trimmedHelix.numAA-1] == 'Y') && (trimmedHelix.sequences[c][trimmedHelix.numAA-1] == 'Y'))
+        opt.trials = 0;
+        opt.helicesRescored = 0;
+    } // end while loop
+    return round;
+}
+
+// Fits the optimized propensity, axial and lateral values on the linearized deviations instead of probing them one delta at a time.
+// Each step takes the gradient of every helix's deviation (DeviationGradient) and solves the linear least squares problem
+// for the change of all values at once, keeping each within maxDev of its experimental value and within a trust region of
+// its current value. The problem is quadratic, so cycling through the values and setting each to its exact (clipped)
+// minimum converges to it. The library is then scored once: the step is kept if the sum of squared deviations drops and the
+// trust region grows, otherwise the values go back and it shrinks. Register choices and the stabilizing / destabilizing
+// split only change between steps, which is why the real sum is always checked.
+// Stops after maxSteps steps, when the linear model sees no further gain or when the trust region falls below delta/100.
+// Returns the number of steps kept; the library is left scored with the final parameters.
+short GradientFit (parameterType & parameters, optimizerState & opt, short maxSteps)
+{
+    const double solveTolerance = 1.0e-6;
+    const short maxSweeps = 200;
+    short k, n, i, sweep;
+    short kept = 0;
+    double step = opt.delta * 5;
+    double largest, predicted, newSSD, sum, norm, target, move;
+    bool gradientsCurrent = false;
+    vector<bool> optimized(featureCount);
+    vector<double> low(featureCount), high(featureCount), change(featureCount), previous(featureCount), residual(opt.TotalHelices);
+    vector<vector<featureEntry>> gradient(opt.TotalHelices);
+    vector<vector<short>> columnHelix(featureCount);
+    vector<vector<double>> columnWeight(featureCount);
+    
+    // Values already outside the box may stay where they are but not move further out, as in OptimizeOneParameter.
+    for (i=0;i<featureCount;i++)
+    {
+        optimized[i] = FeatureOptimized(parameters, i);
+        low[i] = min(ExperimentalValue(parameters, i) - opt.maxDev, FeatureValue(parameters, i));
+        high[i] = max(ExperimentalValue(parameters, i) + opt.maxDev, FeatureValue(parameters, i));
+    }
+    
+    for (k=0;(k<maxSteps) && (step >= opt.delta/100);k++)
+    {
+        if (not gradientsCurrent)
         {
-            theHelix->Propensity[a][b][c][d] += 3;
+            ScoringPool().Run(opt.TotalHelices, [&] (long item) { DeviationGradient(parameters, (*opt.Lib)[item], opt.allOffsets, gradient[item]); });
+            for (i=0;i<featureCount;i++)
+            {
+                columnHelix[i].clear();
+                columnWeight[i].clear();
+            }
+            for (n=0;n<opt.TotalHelices;n++) for (const featureEntry & entry : gradient[n]) if (optimized[entry.feature])
+            {
+                columnHelix[entry.feature].push_back(n);
+                columnWeight[entry.feature].push_back(entry.weight);
+            }
+            gradientsCurrent = true;
         }
-        if ((trimmedHelix.sequences[a][0] == 'W') && (trimmedHelix.sequences[b][0] == 'W') && (trimmedHelix.sequences[c][0] == 'W'))
+        
+        // Solve for the change within the trust region.
+        for (n=0;n<opt.TotalHelices;n++) residual[n] = opt.acceptedDeviation[n];
+        for (i=0;i<featureCount;i++) change[i] = 0;
+        for (sweep=0;sweep<maxSweeps;sweep++)
         {
-            theHelix->Propensity[a][b][c][d] += 3;
+            largest = 0;
+            for (i=0;i<featureCount;i++)
+            {
+                if (columnHelix[i].size() == 0) continue;
+                sum = 0;
+                norm = 0;
+                for (size_t j=0;j<columnHelix[i].size();j++)
+                {
+                    sum += columnWeight[i][j] * residual[columnHelix[i][j]];
+                    norm += columnWeight[i][j] * columnWeight[i][j];
+                }
+                if (norm == 0) continue;
+                target = change[i] - sum/norm;
+                target = max(target, max(-step, low[i] - FeatureValue(parameters, i)));
+                target = min(target, min(step, high[i] - FeatureValue(parameters, i)));
+                move = target - change[i];
+                if (move == 0) continue;
+                for (size_t j=0;j<columnHelix[i].size();j++) residual[columnHelix[i][j]] += columnWeight[i][j] * move;
+                change[i] = target;
+                if (abs(move) > largest) largest = abs(move);
+            }
+            if (largest < solveTolerance) break;
         }
-        if ((trimmedHelix.sequences[a][trimmedHelix.numAA-1] == 'W') && (trimmedHelix.sequences[b][trimmedHelix.numAA-1] == 'W') && (trimmedHelix.sequences[c][trimmedHelix.numAA-1] == 'W'))
+        predicted = 0;
+        for (n=0;n<opt.TotalHelices;n++) predicted += residual[n] * residual[n];
+        if ((opt.sumSquaredDev - predicted) < solveTolerance)
         {
-            theHelix->Propensity[a][b][c][d] += 3;
+            cout << "The linear model finds no further improvement." << endl;
+            break;
         }
         
-        //cout << "capping mod = " << Propensity[a][b][c] << endl;
+        for (i=0;i<featureCount;i++)
+        {
+            previous[i] = FeatureValue(parameters, i);
+            FeatureValue(parameters, i) += change[i];
+        }
+        parameters.version = NextParameterVersion();
+        ScoreLibrary(0, opt.TotalHelices, parameters, *opt.Lib, opt.allOffsets);
+        opt.trials++;
+        opt.helicesRescored += opt.TotalHelices;
+        newSSD = 0;
+        for (n=0;n<opt.TotalHelices;n++) newSSD += ((*opt.Lib)[n].deviation * (*opt.Lib)[n].deviation);
         
-        // // // // // // // // // // //
-        // Terminal Hydrogen Bonding  //
-        // // // // // // // // // // //
-        // if (not theHelix->isXYG) Propensity[a][b][c][d] -= 3.6;
-        if (not trimmedHelix.isXaa(0)) theHelix->Propensity[a][b][c][d] -= 1.8;
-        if (not trimmedHelix.isGly(theHelix->numAA-1)) theHelix->Propensity[a][b][c][d] -= 1.8;
+        if (newSSD < (opt.sumSquaredDev - minImprovement))
+        {
+            kept++;
+            opt.sumSquaredDev = newSSD;
+            for (n=0;n<opt.TotalHelices;n++) opt.acceptedDeviation[n] = (*opt.Lib)[n].deviation;
+            cout << "Fit step #" << kept << " within " << step << ". New SSDev = " << newSSD << " (linear model " << predicted << ")" << endl;
+            step = min(2*step, 2*opt.maxDev);
+            gradientsCurrent = false;
+        }
+        else
+        {
+            for (i=0;i<featureCount;i++) FeatureValue(parameters, i) = previous[i];
+            parameters.version = NextParameterVersion();
+            ScoreLibrary(0, opt.TotalHelices, parameters, *opt.Lib, opt.allOffsets);
+            opt.helicesRescored += opt.TotalHelices;
+            cout << "Fit step within " << step << " rejected. SSDev would be " << newSSD << " (linear model " << predicted << ")" << endl;
+            step /= 2;
+        }
+    }
+    return kept;
+}
+
+// Regression check for PairWiseCalc.
+// Scores every helix of the library while comparing each interaction thread against the original recursion.
+// Helices with any disagreement are shown. Returns true if all threads agreed.
+bool CheckPairWiseCalc (const scoringParameters & parameters, HelixLibrary & Lib, short TotalHelices)
+{
+    short n;
+    long mismatchesBefore;
+    
+    pairWiseCheck.enabled = true;
+    pairWiseCheck.calls = 0;
+    pairWiseCheck.mismatches = 0;
+    pairWiseCheck.worstDifference = 0;
+    
+    for (n=0;n<TotalHelices;n++)
+    {
+        mismatchesBefore = pairWiseCheck.mismatches;
+        // All offsets are scored so the check covers the trimmed threads as well.
+        ScoreHelix(parameters, &Lib[n], true);
+        if (pairWiseCheck.mismatches != mismatchesBefore)
+        {
+            cout << "Helix Number: " << n << ". " << pairWiseCheck.mismatches - mismatchesBefore << " interaction threads disagree." << endl;
+            Lib[n].dissect();
+        }
+    }
+    pairWiseCheck.enabled = false;
+    
+    cout << "Pairwise regression check: " << pairWiseCheck.calls << " interaction threads in " << TotalHelices << " helices." << endl;
+    cout << "Threads where PairWiseCalc and the recursion disagree: " << pairWiseCheck.mismatches << ". Largest difference = " << pairWiseCheck.worstDifference << endl;
+    
+    return (pairWiseCheck.mismatches == 0);
+}
+
+// Regression check for helixSession: an edit of an amino acid the helix doesn't have, followed by a valid one, must
+// still be answered, and its callback called. Returns true if every request of the session was answered.
+bool CheckHelixSession (const scoringParameters & parameters, HelixLibrary & Lib, short TotalHelices)
+{
+    if (TotalHelices < 1) return true;
+    ScoreHelix(parameters, &Lib[0], false);
+    
+    atomic<int> callbacks(0);
+    short answered = 0;
+    bool rejected = false, edited = false;
+    {
+        helixSession session(parameters, Lib[0], false);
+        vector< future<sessionResult> > answers;
+        answers.push_back(session.Scan());
+        answers.push_back(session.Edit(0, 99, 'K', [&callbacks] (const sessionResult &) { callbacks++; }));
+        answers.push_back(session.Edit(0, 1, 'R'));
+        for (size_t k=0;k<answers.size();k++)
+        {
+            try
+            {
+                sessionResult result = answers[k].get();
+                answered++;
+                if (k == 1) rejected = (not result.applied);
+                if (k == 2) edited = (result.applied && (result.helix != NULL) && (result.helix->sequences[0][1] == 'R'));
+            }
+            catch (const future_error & error)
+            {
+                cout << "Session request " << k+1 << " was never answered: " << error.what() << endl;
+            }
+        }
+    }
+    
+    cout << "Session check: " << answered << " of 3 requests answered, " << callbacks << " of 1 callbacks called." << endl;
+    return ((answered == 3) && (callbacks == 1) && rejected && edited);
+}
+
+void pause (double wait)
+{
+    time_t t;
+    t = clock();
+    while ((double(clock() - t)) < wait)
+    {
+        // do nothing
+    }
+}
+
+// The most helices a training library may have. Its helices are numbered with short.
+const long maxTrainingHelices = 32767;
+
+// Reads the date line and the number of helices at the top of a library file. Returns -1 if the file can't be opened.
+long OpenLibrary (ifstream & seq_input, string Lib_Name)
+{
+    long TotalHelices = 0;
+    string seqDate;
+    
+    seq_input.open(Lib_Name);
+    if (!seq_input.is_open())
+    {
+        cout << "We couldn't open the " << Lib_Name << " file." << endl;
+        return -1;
+    }
+    GetLine (seq_input, seqDate);
+    cout << "Sequence Library: " << seqDate << endl;
+    seq_input >> TotalHelices; // indicates the total number of helices to be expected from the text file input
+    return TotalHelices;
+}
+
+// Reads helix number n of a library into theHelix, skipping comment lines (those starting with 0) before it.
+// previous is the helix read before it, if it is still at hand, and is only used to show where a problem is.
+// Returns false if the helix can't be read.
+bool ReadHelix (ifstream & seq_input, TripleHelix & theHelix, TripleHelix * previous, string Lib_Name, long n)
+{
+    short x, y;
+    string killString;
+    char peptideInput[100]; // holds the peptide sequences as they are input
+    
+    PROFILE_SPAN(profileReadHelix);
+    x = 0;
+    seq_input >> theHelix.numPep;
+    while (theHelix.numPep == 0)
+    {
+        GetLine(seq_input, killString);
+        seq_input >> theHelix.numPep;
+        //cout << n << " " << x << " " << killString << endl;
+        x++;
+        if (x>50)
+        {
+            cout << "Problem reading " << Lib_Name << ". Likely problem: is either 1) indicated number of helices exceeds actual number of helices or 2) with commenting." << endl;
+            return false;
+        }
+    }
+    if ((theHelix.numPep < 1) || (theHelix.numPep>3))
+    {
+        cout << "Number of unique peptides in a helix must be 1-3. Value read was Library[" << n << "].numPep = " << theHelix.numPep << ". Stopping now." <<endl;
+        if (previous != NULL) previous->dissect();
+        theHelix.dissect();
+        return false;
+    }
+
+    seq_input >> theHelix.numAA;
+    
+    if ((theHelix.numAA < 21) || (theHelix.numAA>48))
+    {
+        cout << "Number of amino acids in the peptide must be 21-48. Value read was Library[" << n << "].numAA = " << theHelix.numAA  << ". Stopping now." <<endl;
+        if (previous != NULL) previous->dissect();
+        theHelix.dissect();
+        return false;
+    }
+    
+    seq_input >> theHelix.Nterm;
+    seq_input >> theHelix.Cterm;
+    seq_input >> theHelix.expTm;
+            
+    for (x=0; x<theHelix.numPep; x++)
+    {
+        for (y=0;y<theHelix.numAA;y++)
+        {
+            seq_input >> peptideInput[y];
+            theHelix.sequences[x][y] = toupper(peptideInput[y]);
+        }
+    }
+    return true;
+}
+
+short readLibrary (HelixLibrary & Lib, string Lib_Name)
+{
+    short n;
+    ifstream seq_input;
+    PROFILE_SPAN(profileReadLibrary);
+    long count = OpenLibrary(seq_input, Lib_Name);
+    
+    if (count < 0) return 0;
+    if (count > maxTrainingHelices)
+    {
+        cout << Lib_Name << " has " << count << " helices, more than the " << maxTrainingHelices << " a training library can hold." << endl;
+        cout << "Larger libraries can be scored as a user library (--mode library)." << endl;
+        return 0;
+    }
+    short TotalHelices = count;
+    Lib.clear();
+    
+    n = 0; // n tracks the triple helix we are evaluating.
+    for (n=0; n<(TotalHelices); n++)
+    {
+        Lib.add();
+        if (not ReadHelix(seq_input, Lib[n], (n > 0) ? &Lib[n-1] : NULL, Lib_Name, n)) return 0;
+    }
+    seq_input.close();
+    
+    // Determine Xaa, Yaa and Gly positions (reptition)
+    for (n=0; n<(TotalHelices); n++)
+    {
+        Lib[n].determine_reptition();
+        Lib.peptides.intern(Lib[n]);
+    }
         
-        //cout << "terminal H-bond mod = " << Propensity[a][b][c] << endl;
+    
+    
+    
+    
+    
+    
+    return TotalHelices;
+}
+
+// Libraries too large to hold at once (e.g. millions of designed helices) are streamed: a reader thread parses
+// up to streamChunks chunks of streamChunkSize helices ahead, through a bounded queue, while the scoring pool
+// works through the oldest parsed chunk. Memory use stays the same whatever the size of the library.
+const long  streamChunkSize = 256;
+const short streamChunks = 3;
+
+struct libraryStream
+{
+    mutex                   lock;
+    condition_variable      changed;
+    deque<HelixLibrary *>   parsed;     // chunks waiting to be scored, oldest first
+    deque<HelixLibrary *>   spare;      // chunks that can be refilled
+    bool                    finished = false; // the reader has queued its last chunk
+};
+
+// Scores TotalHelices helices, passing each one and its number to report in library order as soon as its chunk
+// has been scored. readHelix(n, theHelix, previous) fills in helix n, ready to score, and returns false if it can't.
+// Returns the number of helices scored, which is less than TotalHelices if the library could not be read to the end.
+long StreamLibrary (const scoringParameters & parameters, long TotalHelices, const function<bool(long, TripleHelix &, TripleHelix *)> & readHelix, bool allOffsets, const function<void(long, TripleHelix &)> & report)
+{
+    libraryStream stream;
+    HelixLibrary chunk[streamChunks];
+    short k;
+    long scored = 0;
+    
+    for (k=0;k<streamChunks;k++) stream.spare.push_back(&chunk[k]);
+    
+    thread reader([&] ()
+    {
+        long n = 0;
+        bool good = true;
         
-        // // // // // // // //
-        // Single AA Score   //
-        // // // // // // // //
-            
-        for (x=0;x<theHelix->numAA;x++)
+        while (good && (n < TotalHelices))
         {
-            if ((trimmedHelix.sequences[a][x] == 'K') || (trimmedHelix.sequences[a][x] == 'R'))
-            {
-                theHelix->netCharge[a][b][c][d]++;
-                theHelix->totalCharge[a][b][c][d]++;
-            }
-            if ((trimmedHelix.sequences[a][x] == 'E') || (trimmedHelix.sequences[a][x] == 'D'))
-            {
-                theHelix->netCharge[a][b][c][d]--;
-                theHelix->totalCharge[a][b][c][d]++;
-            }
-            if ((trimmedHelix.sequences[b][x] == 'K') || (trimmedHelix.sequences[b][x] == 'R'))
-            {
-                theHelix->netCharge[a][b][c][d]++;
-                theHelix->totalCharge[a][b][c][d]++;
-            }
-            if ((trimmedHelix.sequences[b][x] == 'E') || (trimmedHelix.sequences[b][x] == 'D'))
-            {
-                theHelix->netCharge[a][b][c][d]--;
-                theHelix->totalCharge[a][b][c][d]++;
-            }
-            if ((trimmedHelix.sequences[c][x] == 'K') || (trimmedHelix.sequences[c][x] == 'R'))
-            {
-                theHelix->netCharge[a][b][c][d]++;
-                theHelix->totalCharge[a][b][c][d]++;
-            }
-            if ((trimmedHelix.sequences[c][x] == 'E') || (trimmedHelix.sequences[c][x] == 'D'))
+            HelixLibrary * next;
             {
-                theHelix->netCharge[a][b][c][d]--;
-                theHelix->totalCharge[a][b][c][d]++;
+                unique_lock<mutex> hold(stream.lock);
+                stream.changed.wait(hold, [&] { return not stream.spare.empty(); });
+                next = stream.spare.front();
+                stream.spare.pop_front();
             }
             
-            if ((x>2) && (x<(theHelix->numAA-2))) // not the tips
-            {
-            // cout << trimmedHelix.sequences[a][x] << " " << (short)trimmedHelix.sequences[a][x]-64 << endl;
-            if (trimmedHelix.isXaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityX[(short)trimmedHelix.sequences[a][x]-64];
-            if (trimmedHelix.isYaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityY[(short)trimmedHelix.sequences[a][x]-64];
-            
-            if (trimmedHelix.isXaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityX[(short)trimmedHelix.sequences[b][x]-64];
-            if (trimmedHelix.isYaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityY[(short)trimmedHelix.sequences[b][x]-64];
-            
-            if (trimmedHelix.isXaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityX[(short)trimmedHelix.sequences[c][x]-64];
-            if (trimmedHelix.isYaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityY[(short)trimmedHelix.sequences[c][x]-64];
-            }
-            else // the tips
+            next->clear();
+            while (good && (next->size() < streamChunkSize) && (n < TotalHelices))
             {
-                if (trimmedHelix.isXaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityX[(short)trimmedHelix.sequences[a][x]-64]/3;
-                if (trimmedHelix.isYaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityY[(short)trimmedHelix.sequences[a][x]-64]/3;
-                
-                if (trimmedHelix.isXaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityX[(short)trimmedHelix.sequences[b][x]-64]/3;
-                if (trimmedHelix.isYaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityY[(short)trimmedHelix.sequences[b][x]-64]/3;
-                
-                if (trimmedHelix.isXaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityX[(short)trimmedHelix.sequences[c][x]-64]/3;
-                if (trimmedHelix.isYaa(x)) theHelix->Propensity[a][b][c][d] += parameters.propensityY[(short)trimmedHelix.sequences[c][x]-64]/3;
+                long last = next->size();
+                next->add();
+                good = readHelix(n, (*next)[last], (last > 0) ? &(*next)[last-1] : NULL);
+                if (not good) next->removeLast();
+                n++;
             }
+            
+            lock_guard<mutex> hold(stream.lock);
+            stream.parsed.push_back(next);
+            if ((not good) || (n >= TotalHelices)) stream.finished = true;
+            stream.changed.notify_all();
         }
         
-        // Charge Scoring
-        if (abs(theHelix->netCharge[a][b][c][d]) > 6)
+        lock_guard<mutex> hold(stream.lock);
+        stream.finished = true;
+        stream.changed.notify_all();
+    });
+    
+    while (true)
+    {
+        HelixLibrary * current;
         {
-            theHelix->Propensity[a][b][c][d] -= ((abs(theHelix->netCharge[a][b][c][d]) - 6)/3);
+            unique_lock<mutex> hold(stream.lock);
+            stream.changed.wait(hold, [&] { return (not stream.parsed.empty()) || stream.finished; });
+            if (stream.parsed.empty()) break;
+            current = stream.parsed.front();
+            stream.parsed.pop_front();
         }
-
-        // // // // // // // //
-        // set pairwise Tm   //
-        // // // // // // // //
         
-        // FIRST THREAD
-        i = 0;
-        for (x=0;x<theHelix->numAA;x++)
+        ScoreLibrary(0, current->size(), parameters, *current, allOffsets);
+        for (k=0;k<current->size();k++) report(scored + k, (*current)[k]);
+        scored += current->size();
+        
+        lock_guard<mutex> hold(stream.lock);
+        stream.spare.push_back(current);
+        stream.changed.notify_all();
+    }
+    reader.join();
+    return scored;
+}
+
+// // // // // // // // // // //
+// Binary files
+// // // // // // // // // // //
+// Option (4) converts parameters.txt / parameters_exp.txt / opt_list.txt into parameters.bin and seq_input.txt and
+// user_lib.txt into seq_input.bin and user_lib.bin (named after the files actually read, see BinaryName). The text files stay the originals; the binary files only save
+// parsing and are read in their place when binaryInput is set in main. It also writes the interaction counts of the
+// training library to seq_input_counts.bin (see CountsName). Each file is a binaryHeader followed by count fixed-size
+// records (the parameterType itself, one binaryHelix per helix or one interactionCount per pair) in the byte order of the machine
+// that wrote it, so a library can be mapped and any helix read straight from the file. Files with another magic,
+// version or record size are ignored and the text files are read instead.
+const char          binaryParameterMagic[8] = {'S','C','E','P','T','P','A','R'};
+const char          binaryLibraryMagic[8] = {'S','C','E','P','T','L','I','B'};
+const char          binaryScoreMagic[8] = {'S','C','E','P','T','S','C','R'};
+const char          binaryCountsMagic[8] = {'S','C','E','P','T','C','N','T'};
+const unsigned int  binaryVersion = 1;
+
+struct binaryHeader
+{
+    char            magic[8];
+    unsigned int    version;
+    unsigned int    recordSize;
+    long long       count;
+    char            converted[32]; // when the file was written
+};
+
+// A helix with its residues already encoded. The Xaa phase is kept as XaaPos.
+struct binaryHelix
+{
+    short           numPep;
+    short           numAA;
+    short           XaaPos;
+    char            Nterm[8];
+    char            Cterm[8];
+    double          expTm;
+    unsigned char   residue[3][48]; // as TripleHelix::residue
+};
+
+// A read-only binary file, mapped where the system allows it and read into memory otherwise.
+struct binaryFile
+{
+    const char *    data = NULL;
+    size_t          size = 0;
+    vector<char>    buffer;
+    bool            mapped = false;
+    
+    bool open(string name)
+    {
+#ifdef SCEPTTR_MMAP
+        int file = ::open(name.c_str(), O_RDONLY);
+        if (file < 0) return false;
+        struct stat info;
+        if ((fstat(file, &info) == 0) && (info.st_size > 0))
         {
-            if (theHelix->isYaa(x))
+            void * view = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (view != MAP_FAILED)
             {
-                // Populate all values for the First Interaction Thread (both axial and lateral options)
-                // a, b & c are the peptide number of this particular composition / registration
-                // i is tracking the number of Yaa's
-                // x is tracking the amino acid position of the peptide
-                if ((x+2) < trimmedHelix.numAA) XinteractionThread[i] = parameters.axial[(short)trimmedHelix.sequences[a][x]-64][(short)trimmedHelix.sequences[b][x+2]-64];
-                    else XinteractionThread[i] = 0;
-                if ((x-1) >= 0) LinteractionThread[i] = parameters.lateral[(short)trimmedHelix.sequences[a][x]-64][(short)trimmedHelix.sequences[b][x-1]-64];
-                    else LinteractionThread[i] = 0;
-                i++;
+                data = (const char *)view;
+                size = info.st_size;
+                mapped = true;
             }
         }
-                    
-        // find best combination of stabilizing interactions
-        theHelix->PairWise[a][b][c][d] = PairWiseCalc (XinteractionThread, LinteractionThread, 0, numYaa, 9, 0, 0);
-        
-        // force *ALL* possible destabilizing interactions
-        for (x=0;x<numYaa;x++)
+        ::close(file);
+        return mapped;
+#else
+        ifstream file(name, ios::binary);
+        if (!file.is_open()) return false;
+        buffer.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+        data = buffer.data();
+        size = buffer.size();
+        return (size > 0);
+#endif
+    };
+    
+    // The records of a file with this magic and record size, or NULL if it isn't one.
+    const char * records(const char magic[8], size_t recordSize, long long & count)
+    {
+        binaryHeader header;
+        if (size < sizeof(binaryHeader)) return NULL;
+        memcpy(&header, data, sizeof(binaryHeader));
+        if ((memcmp(header.magic, magic, 8) != 0) || (header.version != binaryVersion) || (header.recordSize != recordSize)) return NULL;
+        if ((header.count < 0) || ((size - sizeof(binaryHeader)) / recordSize < (size_t)header.count)) return NULL;
+        count = header.count;
+        header.converted[31] = 0;
+        cout << "Binary file version " << header.version << ", converted " << header.converted << endl;
+        return data + sizeof(binaryHeader);
+    };
+    
+    ~binaryFile()
+    {
+#ifdef SCEPTTR_MMAP
+        if (mapped) munmap((void *)data, size);
+#endif
+    };
+};
+
+// The binary form of a text file: name.txt becomes name.bin.
+string BinaryName (string textName)
+{
+    if ((textName.size() > 4) && (textName.compare(textName.size()-4, 4, ".txt") == 0)) return textName.substr(0, textName.size()-4) + ".bin";
+    return textName + ".bin";
+}
+
+// The interaction counts of a training library: name.txt becomes name_counts.bin.
+string CountsName (string textName)
+{
+    string name = BinaryName(textName);
+    return name.substr(0, name.size()-4) + "_counts.bin";
+}
+
+binaryHeader MakeBinaryHeader (const char magic[8], size_t recordSize, long long count)
+{
+    binaryHeader header;
+    time_t now = ::time(NULL);
+    
+    memset(&header, 0, sizeof(binaryHeader));
+    memcpy(header.magic, magic, 8);
+    header.version = binaryVersion;
+    header.recordSize = recordSize;
+    header.count = count;
+    strftime(header.converted, sizeof(header.converted), "%Y-%m-%d %H:%M:%S", localtime(&now));
+    return header;
+}
+
+bool WriteBinaryParameters (const parameterType & parameters, string name)
+{
+    ofstream file(name, ios::binary);
+    binaryHeader header = MakeBinaryHeader(binaryParameterMagic, sizeof(parameterType), 1);
+    
+    if (!file.is_open()) return false;
+    file.write((const char *)&header, sizeof(binaryHeader));
+    file.write((const char *)&parameters, sizeof(parameterType));
+    return file.good();
+}
+
+// Returns false, leaving parameters alone, if name isn't a usable binary parameter file.
+bool ReadBinaryParameters (parameterType & parameters, string name)
+{
+    binaryFile file;
+    long long count;
+    
+    if (not file.open(name)) return false;
+    const char * record = file.records(binaryParameterMagic, sizeof(parameterType), count);
+    if ((record == NULL) || (count != 1)) return false;
+    memcpy((void *)&parameters, record, sizeof(parameterType));
+    parameters.version = NextParameterVersion();
+    cout << "Parameter File: " << name << endl;
+    return true;
+}
+
+bool WriteInteractionCounts (const interactionIndex & interactions, string name)
+{
+    ofstream file(name, ios::binary);
+    binaryHeader header = MakeBinaryHeader(binaryCountsMagic, sizeof(interactionCount), interactions.counts.size());
+    
+    if (!file.is_open()) return false;
+    file.write((const char *)&header, sizeof(binaryHeader));
+    file.write((const char *)interactions.counts.data(), interactions.counts.size()*sizeof(interactionCount));
+    return file.good();
+}
+
+// Returns false, leaving interactions alone, if name isn't a usable interaction count file.
+bool ReadInteractionCounts (interactionIndex & interactions, string name)
+{
+    binaryFile file;
+    long long count;
+    
+    if (not file.open(name)) return false;
+    const char * record = file.records(binaryCountsMagic, sizeof(interactionCount), count);
+    if (record == NULL) return false;
+    interactions.counts.resize(count);
+    memcpy((void *)interactions.counts.data(), record, count*sizeof(interactionCount));
+    cout << "Interaction counts: " << name << endl;
+    return true;
+}
+
+void PackHelix (const TripleHelix & theHelix, binaryHelix & packed)
+{
+    short p, x;
+    
+    memset(&packed, 0, sizeof(binaryHelix));
+    packed.numPep = theHelix.numPep;
+    packed.numAA = theHelix.numAA;
+    packed.XaaPos = theHelix.XaaPos;
+    strncpy(packed.Nterm, theHelix.Nterm.c_str(), 7);
+    strncpy(packed.Cterm, theHelix.Cterm.c_str(), 7);
+    packed.expTm = theHelix.expTm;
+    for (p=0;p<theHelix.numPep;p++) for (x=0;x<theHelix.numAA;x++) packed.residue[p][x] = theHelix.residue[p][x];
+}
+
+// Fills an initialized theHelix (as from HelixLibrary::add), ready to score, from a packed helix.
+// The sequences are rebuilt from the residue indices.
+// Record n of the file name is checked as ReadHelix checks a text helix, since its counts and residues index fixed
+// arrays. Returns false, after saying why, if it can't be a helix (a stale or damaged file).
+bool UnpackHelix (const binaryHelix & packed, TripleHelix & theHelix, string name, long n)
+{
+    short p, x;
+    
+    if ((packed.numPep < 1) || (packed.numPep > 3))
+    {
+        cout << "Number of unique peptides in a helix must be 1-3. Value read was " << name << "[" << n << "].numPep = " << packed.numPep << ". Stopping now." << endl;
+        return false;
+    }
+    if ((packed.numAA < 21) || (packed.numAA > 48))
+    {
+        cout << "Number of amino acids in the peptide must be 21-48. Value read was " << name << "[" << n << "].numAA = " << packed.numAA << ". Stopping now." << endl;
+        return false;
+    }
+    if ((packed.XaaPos < 0) || (packed.XaaPos > 2))
+    {
+        cout << "The Xaa phase must be 0-2. Value read was " << name << "[" << n << "].XaaPos = " << packed.XaaPos << ". Stopping now." << endl;
+        return false;
+    }
+    for (p=0;p<packed.numPep;p++) for (x=0;x<packed.numAA;x++)
+    {
+        if ((packed.residue[p][x] < 1) || (packed.residue[p][x] > 26))
         {
-            //cout << "Axial Interaction Thread = " << XinteractionThread[i] << " ";
-            if (XinteractionThread[x] < 0) theHelix->PairWise[a][b][c][d] += XinteractionThread[x];
-            if (LinteractionThread[x] < 0) theHelix->PairWise[a][b][c][d] += LinteractionThread[x];
+            cout << "Amino acids must be A-Z. Value read was " << name << "[" << n << "].residue[" << p << "][" << x << "] = " << short(packed.residue[p][x]) << ". Stopping now." << endl;
+            return false;
         }
-        
-        // SECOND THREAD
-        i = 0;
-        for (x=0;x<trimmedHelix.numAA;x++)
+    }
+    
+    theHelix.numPep = packed.numPep;
+    theHelix.numAA = packed.numAA;
+    theHelix.XaaPos = packed.XaaPos;
+    theHelix.Nterm = string(packed.Nterm, strnlen(packed.Nterm, 8));
+    theHelix.Cterm = string(packed.Cterm, strnlen(packed.Cterm, 8));
+    theHelix.expTm = packed.expTm;
+    for (p=0;p<theHelix.numPep;p++) for (x=0;x<theHelix.numAA;x++) theHelix.sequences[p][x] = 64 + packed.residue[p][x];
+    theHelix.encode();
+    return true;
+}
+
+// Returns the number of helices read, or -1 if name isn't a usable binary library (a damaged record, or more helices than the training library can hold).
+short readBinaryLibrary (HelixLibrary & Lib, string name)
+{
+    binaryFile file;
+    long long count, n;
+    
+    if (not file.open(name)) return -1;
+    const char * records = file.records(binaryLibraryMagic, sizeof(binaryHelix), count);
+    if (records == NULL) return -1;
+    if (count > maxTrainingHelices)
+    {
+        cout << name << " has " << count << " helices, more than the " << maxTrainingHelices << " a training library can hold." << endl;
+        return -1;
+    }
+    cout << "Sequence Library: " << name << endl;
+    
+    Lib.clear();
+    for (n=0;n<count;n++)
+    {
+        binaryHelix packed;
+        memcpy(&packed, records + n*sizeof(binaryHelix), sizeof(binaryHelix));
+        if (not UnpackHelix(packed, Lib.add(), name, n)) return -1;
+        Lib.peptides.intern(Lib[n]);
+    }
+    return count;
+}
+
+// Converts a text library to a binary one a helix at a time, so libraries of any size can be converted.
+// Returns the number of helices written, or -1 if either file can't be opened.
+long ConvertLibrary (string textName, string binaryName)
+{
+    ifstream seq_input;
+    long TotalHelices = OpenLibrary(seq_input, textName);
+    long n;
+    TripleHelix theHelix, previous;
+    binaryHelix packed;
+    
+    if (TotalHelices < 0) return -1;
+    ofstream file(binaryName, ios::binary);
+    if (!file.is_open()) return -1;
+    
+    binaryHeader header = MakeBinaryHeader(binaryLibraryMagic, sizeof(binaryHelix), 0);
+    file.write((const char *)&header, sizeof(binaryHeader));
+    for (n=0;n<TotalHelices;n++)
+    {
+        theHelix.initializeAll();
+        if (not ReadHelix(seq_input, theHelix, (n > 0) ? &previous : NULL, textName, n)) break;
+        theHelix.determine_reptition();
+        PackHelix(theHelix, packed);
+        file.write((const char *)&packed, sizeof(binaryHelix));
+        previous = theHelix;
+    }
+    
+    // The count goes in last, once it is known how many helices could be read.
+    header.count = n;
+    file.seekp(0);
+    file.write((const char *)&header, sizeof(binaryHeader));
+    if (not file.good()) return -1;
+    return n;
+}
+
+// // // // // // // // // // //
+// Batch output
+// // // // // // // // // // //
+// Scored libraries are written as one compact record per helix rather than the colored console view of userOutput.
+// Records are collected in memory and written out in large blocks, never flushed per helix.
+enum outputFormat { consoleOutput, csvOutput, jsonOutput, binaryOutput };
+
+// One record of a binary score file, after a binaryHeader with binaryScoreMagic. Registers are {lead, middle, trail, offset}.
+// count in the header is 0 when the records were written to the standard output, where it can't be filled in at the end.
+struct binaryScore
+{
+    long long   helix;          // 1 is the first helix of the library
+    short       numPep;
+    short       numAA;
+    short       bestRegister[4];
+    short       secRegister[4];
+    short       CCRegister[4];
+    short       netCharge;      // of the best register
+    short       totalCharge;
+    double      expTm;
+    double      HighTm;
+    double      bestPropensity;
+    double      bestPairwise;
+    double      secTm;
+    double      CCTm;
+    double      specificity;
+};
+
+struct batchWriter
+{
+    outputFormat    format = consoleOutput;
+    ofstream        file;
+    ostream *       out = NULL;
+    string          pending;
+    long long       count = 0;
+    // When set, the csv and json records also give the number of low confidence interactions of each helix
+    // (LowConfidence). The binary records stay as binaryScore.
+    const interactionIndex * confidence = NULL;
+    
+    static const size_t blockSize = 1 << 16;
+    
+    // Opens name, or the standard output if name is "-", and writes the header of the format. Returns false if name can't be opened.
+    bool open(outputFormat theFormat, string name)
+    {
+        format = theFormat;
+        count = 0;
+        pending.clear();
+        if (name == "-") out = &cout;
+        else
         {
-            if (trimmedHelix.isYaa(x))
-            {
-                // Populate all values for the Second Interaction Thread (both axial and lateral options)
-                if ((x+2) < theHelix->numAA)
-                    XinteractionThread[i] = parameters.axial[(short)trimmedHelix.sequences[b][x]-64][(short)trimmedHelix.sequences[c][x+2]-64];
-                else
-                    XinteractionThread[i] = 0;
-                if ((x-1) >= 0)
-                    LinteractionThread[i] = parameters.lateral[(short)trimmedHelix.sequences[b][x]-64][(short)trimmedHelix.sequences[c][x-1]-64];
-                else
-                    LinteractionThread[i] = 0;
-                i++;
-            }
+            file.open(name, ios::binary);
+            if (!file.is_open()) return false;
+            out = &file;
         }
         
-        // find best combination of stabilizing interactions
-        theHelix->PairWise[a][b][c][d] += PairWiseCalc (XinteractionThread, LinteractionThread, 0, numYaa, 9, 0, 0);
-        
-        // force *ALL* possible destabilizing interactions
-        for (x=0;x<numYaa;x++)
+        if (format == csvOutput) pending += "helix,numPep,numAA,Nterm,Cterm,sequences,expTm,HighTm,bestRegister,bestOffset,bestPropensity,bestPairwise,netCharge,totalCharge,secTm,secRegister,secOffset,CCTm,CCRegister,specificity";
+        if ((format == csvOutput) && (confidence != NULL)) pending += ",lowConfidence";
+        if (format == csvOutput) pending += "\n";
+        if (format == binaryOutput)
         {
-            if (XinteractionThread[x] < 0) theHelix->PairWise[a][b][c][d] += XinteractionThread[x];
-            if (LinteractionThread[x] < 0) theHelix->PairWise[a][b][c][d] += LinteractionThread[x];
+            binaryHeader header = MakeBinaryHeader(binaryScoreMagic, sizeof(binaryScore), 0);
+            pending.append((const char *)&header, sizeof(binaryHeader));
         }
+        return true;
+    };
+    
+    void write(long n, const TripleHelix & theHelix)
+    {
+        const short * best = theHelix.bestRegister;
+        const short * sec = theHelix.secRegister;
+        short netCharge = theHelix.netCharge[best[0]][best[1]][best[2]][best[3]];
+        short totalCharge = theHelix.totalCharge[best[0]][best[1]][best[2]][best[3]];
+        string peptides;
+        short p;
         
-        // THIRD THREAD
-        i = 0;
-        for (x=0;x<trimmedHelix.numAA;x++)
+        PROFILE_COUNT(profileOutput, 0);
+        count++;
+        if (format == binaryOutput)
         {
-            if (trimmedHelix.isYaa(x))
+            binaryScore record;
+            memset(&record, 0, sizeof(binaryScore));
+            record.helix = n+1;
+            record.numPep = theHelix.numPep;
+            record.numAA = theHelix.numAA;
+            for (p=0;p<4;p++)
             {
-                // Populate all values for the Third Interaction Thread (both axial and lateral options)
-                if ((x+5) < theHelix->numAA)
-                    XinteractionThread[i] = parameters.axial[(short)trimmedHelix.sequences[c][x]-64][(short)trimmedHelix.sequences[a][x+5]-64];
-                else
-                    XinteractionThread[i] = 0;
-                if ((x+2) < theHelix->numAA)
-                    LinteractionThread[i] = parameters.lateral[(short)trimmedHelix.sequences[c][x]-64][(short)trimmedHelix.sequences[a][x+2]-64];
-                else
-                    LinteractionThread[i] = 0;
-                i++;
+                record.bestRegister[p] = best[p];
+                record.secRegister[p] = sec[p];
+                record.CCRegister[p] = theHelix.CCRegister[p];
             }
+            record.netCharge = netCharge;
+            record.totalCharge = totalCharge;
+            record.expTm = theHelix.expTm;
+            record.HighTm = theHelix.HighTm;
+            record.bestPropensity = theHelix.bestPropensity;
+            record.bestPairwise = theHelix.bestPairwise;
+            record.secTm = theHelix.secTm;
+            record.CCTm = theHelix.CCTm;
+            record.specificity = theHelix.specificity;
+            pending.append((const char *)&record, sizeof(binaryScore));
         }
-        
-        // find best combination of stabilizing interactions
-        theHelix->PairWise[a][b][c][d] += PairWiseCalc (XinteractionThread, LinteractionThread, 0, numYaa, 9, 0, 0);
-        // force *ALL* possible destabilizing interactions
-        for (x=0;x<numYaa;x++)
+        else
         {
-            if (XinteractionThread[x] < 0) theHelix->PairWise[a][b][c][d] += XinteractionThread[x];
-            if (LinteractionThread[x] < 0) theHelix->PairWise[a][b][c][d] += LinteractionThread[x];
+            string register3 = to_string(best[0]) + to_string(best[1]) + to_string(best[2]);
+            string CCRegister3 = to_string(theHelix.CCRegister[0]) + to_string(theHelix.CCRegister[1]) + to_string(theHelix.CCRegister[2]);
+            // A helix with a single register has no second best, and so no specificity either.
+            bool hasSecond = ((sec[3] >= 0) && (sec[3] < 9));
+            string secRegister3 = hasSecond ? (to_string(sec[0]) + to_string(sec[1]) + to_string(sec[2])) : "";
+            if (format == csvOutput)
+            {
+                for (p=0;p<theHelix.numPep;p++)
+                {
+                    if (p > 0) peptides += "/";
+                    peptides.append(theHelix.sequences[p], theHelix.numAA);
+                }
+                pending += to_string(n+1) + "," + to_string(theHelix.numPep) + "," + to_string(theHelix.numAA) + ",";
+                AppendCsv(pending, theHelix.Nterm);
+                pending += ",";
+                AppendCsv(pending, theHelix.Cterm);
+                pending += ",";
+                AppendCsv(pending, peptides);
+                pending += ",";
+                AppendNumber(pending, theHelix.expTm);
+                pending += ",";
+                AppendNumber(pending, theHelix.HighTm);
+                pending += "," + register3 + "," + offsetName[best[3]] + ",";
+                AppendNumber(pending, theHelix.bestPropensity);
+                pending += ",";
+                AppendNumber(pending, theHelix.bestPairwise);
+                pending += "," + to_string(netCharge) + "," + to_string(totalCharge) + ",";
+                if (hasSecond)
+                {
+                    AppendNumber(pending, theHelix.secTm);
+                    pending += "," + secRegister3 + "," + offsetName[sec[3]];
+                }
+                else pending += ",,";
+                pending += ",";
+                AppendNumber(pending, theHelix.CCTm);
+                pending += "," + CCRegister3 + ",";
+                if (hasSecond) AppendNumber(pending, theHelix.specificity);
+                if (confidence != NULL) pending += "," + to_string(LowConfidence(theHelix, *confidence).total);
+                pending += "\n";
+            }
+            else
+            {
+                pending += "{\"helix\":" + to_string(n+1) + ",\"numPep\":" + to_string(theHelix.numPep) + ",\"numAA\":" + to_string(theHelix.numAA) + ",\"Nterm\":";
+                AppendJson(pending, theHelix.Nterm);
+                pending += ",\"Cterm\":";
+                AppendJson(pending, theHelix.Cterm);
+                pending += ",\"sequences\":[";
+                for (p=0;p<theHelix.numPep;p++)
+                {
+                    if (p > 0) pending += ",";
+                    AppendJson(pending, string(theHelix.sequences[p], theHelix.numAA));
+                }
+                pending += "],\"expTm\":";
+                AppendNumber(pending, theHelix.expTm);
+                pending += ",\"HighTm\":";
+                AppendNumber(pending, theHelix.HighTm);
+                pending += ",\"bestRegister\":\"" + register3 + "\",\"bestOffset\":\"" + offsetName[best[3]] + "\",\"bestPropensity\":";
+                AppendNumber(pending, theHelix.bestPropensity);
+                pending += ",\"bestPairwise\":";
+                AppendNumber(pending, theHelix.bestPairwise);
+                pending += ",\"netCharge\":" + to_string(netCharge) + ",\"totalCharge\":" + to_string(totalCharge) + ",\"secTm\":";
+                if (hasSecond)
+                {
+                    AppendNumber(pending, theHelix.secTm);
+                    pending += ",\"secRegister\":\"" + secRegister3 + "\",\"secOffset\":\"" + offsetName[sec[3]] + "\"";
+                }
+                else pending += "null,\"secRegister\":null,\"secOffset\":null";
+                pending += ",\"CCTm\":";
+                AppendNumber(pending, theHelix.CCTm);
+                pending += ",\"CCRegister\":\"" + CCRegister3 + "\",\"specificity\":";
+                if (hasSecond) AppendNumber(pending, theHelix.specificity);
+                else pending += "null";
+                if (confidence != NULL) pending += ",\"lowConfidence\":" + to_string(LowConfidence(theHelix, *confidence).total);
+                pending += "}\n";
+            }
         }
-        
-        //cout << "Pairwise Mod = " << PairWise[a][b][c] << endl;
-        
-        // Calculate the Tm for this composition / register determined.
-        theHelix->Tm[a][b][c][d] = theHelix->Propensity[a][b][c][d] + theHelix->PairWise[a][b][c][d];
-        
-        //cout << "Tm = " << Tm[a][b][c] << " = " << Propensity[a][b][c] << " + " << PairWise[a][b][c] << endl;
-        
-        // Determine if this is the best and remember the best & second best registers.
-        if (theHelix->Tm[a][b][c][d] >= maxTm)
+        if (pending.size() >= blockSize) flush();
+    };
+    
+    void flush(void)
+    {
+        if (out == NULL) return;
+        PROFILE_SPAN(profileOutput, pending.size());
+        out->write(pending.data(), pending.size());
+        pending.clear();
+    };
+    
+    // Writes what is left and, for a binary file, fills in the number of records.
+    void close(void)
+    {
+        flush();
+        if (out == NULL) return;
+        if ((format == binaryOutput) && (out == &file))
         {
-            secondBestTm = maxTm;
-            secondBestReg[0] = bestReg[0];
-            secondBestReg[1] = bestReg[1];
-            secondBestReg[2] = bestReg[2];
-            secondBestReg[3] = bestReg[3];
-            
-            maxTm = theHelix->Tm[a][b][c][d];
-            bestReg[0] = a;
-            bestReg[1] = b;
-            bestReg[2] = c;
-            bestReg[3] = d;
+            binaryHeader header = MakeBinaryHeader(binaryScoreMagic, sizeof(binaryScore), count);
+            file.seekp(0);
+            file.write((const char *)&header, sizeof(binaryHeader));
         }
-        else
+        if (out == &file) file.close();
+        else out->flush();
+        out = NULL;
+    };
+};
+
+// // // // // // // // // // //
+// Scoring service
+// // // // // // // // // // //
+// Option (9) keeps the parameters and the scoring pool (and with --cache scoreCache) resident and scores helices as they are sent, so
+// front ends and design scripts don't pay for starting the program and reading its files on every call.
+// A request is one line in the form of a library entry, numPep numAA Nterm Cterm expTm and then each peptide as one word:
+//     2 30 ac am 0 PKGEOGPKGEOGPKGEOGPKGEOGPKGEOG EKGPOGEKGPOGPKGEOGPKGEOGPKGEOG
+// A blank line (or the end of the input) ends a batch. The helices of a batch are scored together on the pool and
+// answered, in order, with one record each as --format json writes them (numbered from 1 over the connection) and
+// then a blank line. A request that can't be read is answered with {"helix":n,"error":"..."} in its place.
+
+// Reads one request into theHelix, which must be initialized (as from HelixLibrary::add).
+// Returns false, with the reason in problem, if the line isn't a helix that can be scored.
+bool ParseHelixRecord (const string & line, TripleHelix & theHelix, string & problem)
+{
+    istringstream record(line);
+    string peptide;
+    short p, x;
+    
+    if (not (record >> theHelix.numPep >> theHelix.numAA >> theHelix.Nterm >> theHelix.Cterm >> theHelix.expTm))
+    {
+        problem = "expected numPep numAA Nterm Cterm expTm and the peptides";
+        return false;
+    }
+    if ((theHelix.numPep < 1) || (theHelix.numPep > 3))
+    {
+        problem = "numPep must be 1-3";
+        return false;
+    }
+    if ((theHelix.numAA < 21) || (theHelix.numAA > 48))
+    {
+        problem = "numAA must be 21-48";
+        return false;
+    }
+    for (p=0;p<theHelix.numPep;p++)
+    {
+        if ((not (record >> peptide)) || ((short)peptide.size() != theHelix.numAA))
         {
-            if (theHelix->Tm[a][b][c][d] >= secondBestTm)
-            {
-                secondBestTm = theHelix->Tm[a][b][c][d];
-                secondBestReg[0] = a;
-                secondBestReg[1] = b;
-                secondBestReg[2] = c;
-                secondBestReg[3] = d;
-            }
+            problem = "expected " + to_string(theHelix.numPep) + " peptides of " + to_string(theHelix.numAA) + " amino acids";
+            return false;
         }
-        
-        if (theHelix->numPep == 1)
+        for (x=0;x<theHelix.numAA;x++)
         {
-            if (theHelix->Tm[a][b][c][d] >= theHelix->CCTm)
+            if (not isalpha((unsigned char)peptide[x]))
             {
-                //cout << "Setting CCTm for homotrimer" << endl;
-                theHelix->CCTm = theHelix->Tm[a][b][c][d];
-                theHelix->CCRegister[0] = a;
-                theHelix->CCRegister[1] = b;
-                theHelix->CCRegister[2] = c;
+                problem = "peptides must be single letter amino acid codes";
+                return false;
             }
+            theHelix.sequences[p][x] = toupper(peptide[x]);
+        }
+    }
+    if (record >> peptide)
+    {
+        problem = "more peptides than numPep";
+        return false;
+    }
+    theHelix.determine_reptition();
+    return true;
+}
+
+// Answers the batches of requests nextLine gives until it has no more lines, passing each answer to answer as a whole.
+// Unless confidence is NULL each record also gives the helix's low confidence interactions. Returns the number of helices scored.
+long ServeRequests (const scoringParameters & parameters, bool allOffsets, const interactionIndex * confidence, const function<bool(string &)> & nextLine, const function<void(const string &)> & answer)
+{
+    HelixLibrary batch;
+    vector<string> problems;
+    batchWriter records;
+    string line;
+    long numbered = 0, scored = 0;
+    long k;
+    bool more = true;
+    
+    // Nothing is opened, so the records stay in records.pending until they are answered.
+    records.format = jsonOutput;
+    records.confidence = confidence;
+    while (more)
+    {
+        batch.clear();
+        problems.clear();
+        while ((more = nextLine(line)) && (line.find_first_not_of(" \t\r") != string::npos))
+        {
+            problems.push_back("");
+            ParseHelixRecord(line, batch.add(), problems.back());
         }
+        if (batch.size() == 0) continue;
         
-        if ((theHelix->numPep == 2) && ((a != b) || (a != c) || (b != c)))
+        ScoringPool().Run(batch.size(), [&] (long item)
         {
-            
-            if (theHelix->Tm[a][b][c][d] >= theHelix->CCTm)
+            if (problems[item] == "") ScoreHelix(parameters, &batch[item], allOffsets);
+        });
+        for (k=0;k<batch.size();k++)
+        {
+            if (problems[k] == "")
             {
-                //cout << "This is an A2B register: " << n << " " <<bestReg[0]<<bestReg[1]<<bestReg[2] << endl;
-                theHelix->CCTm = theHelix->Tm[a][b][c][d];
-                theHelix->CCRegister[0] = a;
-                theHelix->CCRegister[1] = b;
-                theHelix->CCRegister[2] = c;
-                theHelix->CCRegister[3] = d;
+                records.write(numbered + k, batch[k]);
+                scored++;
+            }
+            else
+            {
+                records.pending += "{\"helix\":" + to_string(numbered + k + 1) + ",\"error\":";
+                AppendJson(records.pending, problems[k]);
+                records.pending += "}\n";
             }
         }
-            
-        if ((theHelix->numPep == 3) && ((a != b) && (a != c) && (b != c)))
+        numbered += batch.size();
+        records.pending += "\n";
+        answer(records.pending);
+        records.pending.clear();
+    }
+    return scored;
+}
+
+#ifdef SCEPTTR_SOCKETS
+// Serves every client of the Unix domain socket at path on a thread of its own until the program is stopped.
+// The clients share the scoring pool and, with --cache, scoreCache. Returns false if the socket can't be set up.
+bool ServeSocket (const scoringParameters & parameters, bool allOffsets, const interactionIndex * confidence, string path)
+{
+    sockaddr_un address;
+    
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+    {
+        cout << "The socket name " << path << " is too long." << endl;
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    // A client that leaves before it is answered must not stop the server.
+    signal(SIGPIPE, SIG_IGN);
+    unlink(path.c_str()); // left by an earlier run
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if ((listener < 0) || (bind(listener, (sockaddr *)&address, sizeof(address)) != 0) || (listen(listener, 64) != 0))
+    {
+        cout << "We couldn't listen on " << path << "." << endl;
+        if (listener >= 0) close(listener);
+        return false;
+    }
+    cout << "Listening on " << path << endl;
+    
+    while (true)
+    {
+        int client = accept(listener, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR) continue;
+            cout << "We couldn't accept a client on " << path << ". Stopping." << endl;
+            close(listener);
+            return false;
+        }
+        thread([&parameters, allOffsets, confidence, client] ()
         {
+            string received;
+            size_t start = 0;
+            char block[1 << 14];
             
-            if (theHelix->Tm[a][b][c][d] >= theHelix->CCTm)
+            // The next line sent, the last one even without a newline. False once the client has closed its end.
+            auto nextLine = [&] (string & line)
             {
-                //cout << "This is an ABC register: " << n << " " <<bestReg[0]<<bestReg[1]<<bestReg[2] << endl;
-                theHelix->CCTm = theHelix->Tm[a][b][c][d];
-                theHelix->CCRegister[0] = a;
-                theHelix->CCRegister[1] = b;
-                theHelix->CCRegister[2] = c;
-                theHelix->CCRegister[3] = d;
-            }
-        }
-        
-        
-    } // end for abcd
+                size_t end;
+                while ((end = received.find('\n', start)) == string::npos)
+                {
+                    received.erase(0, start);
+                    start = 0;
+                    ssize_t got = recv(client, block, sizeof(block), 0);
+                    if ((got < 0) && (errno == EINTR)) continue;
+                    if (got <= 0)
+                    {
+                        if (received.size() == 0) return false;
+                        line.swap(received);
+                        received.clear();
+                        return true;
+                    }
+                    received.append(block, got);
+                }
+                line.assign(received, start, end - start);
+                start = end + 1;
+                return true;
+            };
+            auto answer = [client] (const string & records)
+            {
+                size_t sent = 0;
+                while (sent < records.size())
+                {
+                    ssize_t done = send(client, records.data() + sent, records.size() - sent, 0);
+                    if ((done < 0) && (errno == EINTR)) continue;
+                    if (done <= 0) return;
+                    sent += done;
+                }
+            };
+            ServeRequests(parameters, allOffsets, confidence, nextLine, answer);
+            close(client);
+        }).detach();
+    }
+}
+#endif
+
+// // // // // // // // // // //
+// Benchmarks
+// // // // // // // // // // //
+// Wall clock timings of the scoring kernel and the optimizer, run by option (6). These use steady_clock, because
+// clock() adds up the CPU time of every thread and can't show how scoring scales with the number of threads.
+// Everything is timed on copies, so the parameters and the training library are left as they were.
+
+double SecondsSince (chrono::steady_clock::time_point start)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Runs job until at least minSeconds have passed (and at least once) and returns the seconds per run.
+double TimeRuns (const function<void(void)> & job, double minSeconds = 0.25)
+{
+    long runs = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
     
+    do
+    {
+        job();
+        runs++;
+    } while (SecondsSince(start) < minSeconds);
+    return SecondsSince(start) / runs;
+}
+
+// Keeps whatever the timed code prints off the standard output while it is in scope.
+struct quietOutput
+{
+    streambuf * shown;
     
-    // move all values to the helix parameters...
-    theHelix->HighTm = maxTm;
-    theHelix->bestRegister[0] = bestReg[0];
-    theHelix->bestRegister[1] = bestReg[1];
-    theHelix->bestRegister[2] = bestReg[2];
-    theHelix->bestRegister[3] = bestReg[3];
-    theHelix->bestPropensity = theHelix->Propensity[theHelix->bestRegister[0]][theHelix->bestRegister[1]][theHelix->bestRegister[2]][theHelix->bestRegister[3]];
-    theHelix->bestPairwise = theHelix->PairWise[theHelix->bestRegister[0]][theHelix->bestRegister[1]][theHelix->bestRegister[2]][theHelix->bestRegister[3]];
-    theHelix->secTm = secondBestTm;
-    theHelix->secRegister[0] = secondBestReg[0];
-    theHelix->secRegister[1] = secondBestReg[1];
-    theHelix->secRegister[2] = secondBestReg[2];
-    theHelix->secRegister[3] = secondBestReg[3];
-    theHelix->specificity = maxTm - secondBestTm;
-    // This sets the deviation as between the experimental Tm and the correct composition / register found here.
-    // This was originally created to allow known systems that have POGn peptides with high Tm to be scored for
-    // their ABC or A2B helix. However it likely introduces some problems in optimization.
-    // theHelix->deviation = theHelix->CCTm - theHelix->expTm;
-    // // // // // // // // // // // //
-    // Using maxTm is more rigorous but has its own set of problems.
-    // theHelix->deviation = maxTm - theHelix->expTm;
-    // Third option uses maxTm and the differenct between maxTm and CCTm for the difference score
+    quietOutput ()
+    {
+        shown = cout.rdbuf(NULL);
+    }
     
-    if ((theHelix->CCRegister[0] == theHelix->bestRegister[0]) && (theHelix->CCRegister[1] == theHelix->bestRegister[1]) && (theHelix->CCRegister[2] == theHelix->bestRegister[2]))
+    ~quietOutput ()
     {
-        // The best register and expected register (CCregisters) are the same. This does not consider non-canonical registers.
-        if (theHelix->expTm == -10)
+        cout.rdbuf(shown);
+        cout.clear();
+    }
+};
+
+// count random helices of numAA amino acids (1-3 peptides each) with Gly in every third position and Xaa / Yaa
+// drawn from the residues the training library mostly uses. The same seed gives the same library.
+void SyntheticLibrary (HelixLibrary & Lib, short numAA, long count, unsigned seed)
+{
+    const string XaaResidues = "PPPPEEDKRAFYWQSL";
+    const string YaaResidues = "OOOOKKRREDAQSTLY";
+    mt19937 generator(seed);
+    long n;
+    short p, x;
+    
+    Lib.clear();
+    for (n=0;n<count;n++)
+    {
+        TripleHelix & theHelix = Lib.add();
+        theHelix.numPep = 1 + n%3;
+        theHelix.numAA = numAA;
+        theHelix.Nterm = (n%2) ? "ac" : "n";
+        theHelix.Cterm = (n%4 < 2) ? "am" : "c";
+        theHelix.expTm = 0;
+        for (p=0;p<theHelix.numPep;p++) for (x=0;x<numAA;x++)
         {
-            // an experimental Tm of -10 indicates that no transition was observed experimentally. Only penalize Tm's higher than 10C.
-            if (maxTm <= 10) theHelix->deviation = 0; else theHelix->deviation = maxTm - 10;
+            if (x%3 == 0) theHelix.sequences[p][x] = XaaResidues[generator() % XaaResidues.size()];
+            if (x%3 == 1) theHelix.sequences[p][x] = YaaResidues[generator() % YaaResidues.size()];
+            if (x%3 == 2) theHelix.sequences[p][x] = 'G';
         }
-        else
-            theHelix->deviation = maxTm - theHelix->expTm;
+        theHelix.determine_reptition();
     }
-    else
+}
+
+// Registers ScoreHelix scores in helices 0 ... count-1 of Lib.
+long RegisterCount (HelixLibrary & Lib, long count, bool allOffsets)
+{
+    long registers = 0;
+    for (long n=0;n<count;n++) registers += Lib[n].numPep * Lib[n].numPep * Lib[n].numPep * (allOffsets ? 9 : 1);
+    return registers;
+}
+
+// Times ScoreHelix over helices 0 ... count-1 of Lib on the calling thread and reports helices/s and ns per register.
+void BenchmarkScoreHelix (const scoringParameters & parameters, HelixLibrary & Lib, long count, bool allOffsets, string name)
+{
+    double seconds = TimeRuns([&] { for (long n=0;n<count;n++) ScoreHelix(parameters, &Lib[n], allOffsets); });
+    cout << "ScoreHelix, " << name << (allOffsets ? ", all offsets: " : ", canonical: ") << count / seconds << " helices/s, ";
+    cout << 1.0e9 * seconds / RegisterCount(Lib, count, allOffsets) << " ns/register" << endl;
+}
+
+void RunBenchmarks (const parameterType & parameters, HelixLibrary & Library, short TotalHelices, const libraryIndexType & libraryIndex, string trainingLibrary, double delta, double maxDev)
+{
+    const short shortestThread = 7, longestThread = 16;   // Yaa per interaction thread of 21 and 48 amino acid peptides
+    const short longestRecursion = 12;                      // the recursion takes about 3^(Yaa) calls, so longer threads aren't timed
+    double XPW[50], LPW[50];
+    double seconds, sink = 0;
+    short lastPair, k, numAA, numThreads;
+    HelixLibrary parsed, Lib, synthetic;
+    mt19937 generator(1);
+    uniform_real_distribution<double> interaction(-1.0, 2.0);
+    
+    cout << "Benchmarks (wall clock, steady_clock)" << endl;
+    
+    // // // // // // // //
+    // PairWiseCalc
+    // // // // // // // //
+    for (lastPair=shortestThread;lastPair<=longestThread;lastPair++)
     {
-        // The best register and the expected register are not the same.
-        // Score as above but with additional penalty for wrong register.
-        if (theHelix->expTm == -10)
+        for (k=0;k<=lastPair;k++)
         {
-            if (maxTm <= 10) theHelix->deviation = 0;
-            if (maxTm >  10) theHelix->deviation = maxTm - 10;
+            XPW[k] = interaction(generator);
+            LPW[k] = interaction(generator);
         }
-        else
+        seconds = TimeRuns([&] { for (k=0;k<1000;k++) sink += PairWiseCalc(XPW, LPW, lastPair); }) / 1000;
+        cout << "PairWiseCalc, " << lastPair << " Yaa: " << 1.0e9 * seconds << " ns/thread";
+        if (lastPair <= longestRecursion)
         {
-            theHelix->deviation = theHelix->CCTm - theHelix->expTm;
-            if (theHelix->deviation < 0)
-            {
-                // cout << "Deviation was: " << theHelix->deviation << ". Penalty of " << -0.5*(abs(theHelix->CCTm - maxTm)) << " applied. Final Deviation: ";
-                theHelix->deviation -= 0.5*(abs(theHelix->CCTm - maxTm));
-                //cout <<  theHelix->deviation << endl;
-            }
-            else
-            {
-                // cout << "Deviation was: " << theHelix->deviation << ". Penalty of " << 0.5*(abs(theHelix->CCTm - maxTm)) << " applied. Final Deviation: ";
-                theHelix->deviation += 0.5*(abs(theHelix->CCTm - maxTm));
-                //cout <<  theHelix->deviation << endl;
-            }
+            seconds = TimeRuns([&] { sink += PairWiseCalcRecursive(XPW, LPW, 0, lastPair, 9, 0, 0); });
+            cout << ", recursion " << 1.0e9 * seconds << " ns/thread";
         }
+        cout << endl;
     }
+    if (sink == 0.5) cout << endl; // keeps the timed calls from being optimized away
+    cout << endl;
     
-
+    // // // // // // // //
+    // Parsing and scoring the training library
+    // // // // // // // //
+    {
+        quietOutput quiet;
+        seconds = TimeRuns([&] { readLibrary(parsed, trainingLibrary); });
+    }
+    cout << "readLibrary " << trainingLibrary << ": " << 1000 * seconds << " ms, " << parsed.size() / seconds << " helices/s" << endl;
+    for (short n=0;n<TotalHelices;n++) Lib.add() = Library[n];
     
+    BenchmarkScoreHelix(parameters, Lib, TotalHelices, false, trainingLibrary);
+    BenchmarkScoreHelix(parameters, Lib, TotalHelices, true, trainingLibrary);
+    // Each kind of helix on its own, as each has a scoring kernel of its own (see ScoreRegisterKernel).
+    const string kindName[3] = {"homotrimers", "A2B", "ABC"};
+    for (k=0;k<3;k++)
+    {
+        HelixLibrary kind;
+        for (short n=0;n<TotalHelices;n++) if (Library[n].numPep == k+1) kind.add() = Library[n];
+        if (kind.size() == 0) continue;
+        BenchmarkScoreHelix(parameters, kind, kind.size(), false, trainingLibrary + " " + kindName[k]);
+        BenchmarkScoreHelix(parameters, kind, kind.size(), true, trainingLibrary + " " + kindName[k]);
+        if (k == 0) continue; // homotrimers are always scored in full
+        topTwoScoring = true;
+        BenchmarkScoreHelix(parameters, kind, kind.size(), false, trainingLibrary + " " + kindName[k] + " top two");
+        BenchmarkScoreHelix(parameters, kind, kind.size(), true, trainingLibrary + " " + kindName[k] + " top two");
+        topTwoScoring = false;
+    }
+    for (k=0;k<2;k++)
+    {
+        seconds = TimeRuns([&] { ScoreLibrary(0, TotalHelices, parameters, Lib, (k == 1)); });
+        cout << "ScoreLibrary, " << ScoringPool().workers.size() << " threads" << ((k == 1) ? ", all offsets: " : ", canonical: ") << TotalHelices / seconds << " helices/s" << endl;
+    }
+    cout << endl;
+    
+    // // // // // // // //
+    // Thread scaling
+    // // // // // // // //
+    // Powers of two up to the number of hardware threads, and that number itself.
+    short maxThreads = max((short)2, (short)thread::hardware_concurrency());
+    vector<short> threadCounts;
+    for (numThreads=1;numThreads<maxThreads;numThreads*=2) threadCounts.push_back(numThreads);
+    threadCounts.push_back(maxThreads);
+    double oneThread = 0;
+    for (short numThreads : threadCounts)
+    {
+        WorkerPool pool(numThreads);
+        seconds = TimeRuns([&] { pool.Run(TotalHelices, [&] (long n) { ScoreHelix(parameters, &Lib[n], true); }); });
+        if (numThreads == 1) oneThread = seconds;
+        cout << "Scoring threads = " << numThreads << ": " << TotalHelices / seconds << " helices/s (all offsets), speedup " << oneThread / seconds << endl;
+    }
+    cout << endl;
+    
+    // // // // // // // //
+    // Synthetic libraries
+    // // // // // // // //
+    for (numAA=21;numAA<=48;numAA+=3)
+    {
+        SyntheticLibrary(synthetic, numAA, 300, numAA);
+        BenchmarkScoreHelix(parameters, synthetic, synthetic.size(), false, to_string(numAA) + " aa");
+        BenchmarkScoreHelix(parameters, synthetic, synthetic.size(), true, to_string(numAA) + " aa");
+    }
+    cout << endl;
+    
+    // // // // // // // //
+    // Several parameter sets
+    // // // // // // // //
+    parameterSets sets;
+    for (k=0;k<4;k++) sets.add(parameters, "parameters");
+    sets.arrange();
+    seconds = TimeRuns([&] { for (k=0;k<sets.count;k++) ScoreLibrary(0, TotalHelices, parameters, Lib, false); });
+    cout << "ScoreLibrary once per set, " << sets.count << " sets: " << TotalHelices / seconds << " helices/s" << endl;
+    seconds = TimeRuns([&] { ScoreLibrarySets(sets, Lib, TotalHelices, false); });
+    cout << "ScoreLibrarySets, " << sets.count << " sets: " << TotalHelices / seconds << " helices/s" << endl;
+    cout << endl;
     
+    // // // // // // // //
+    // One optimizer round
+    // // // // // // // //
+    parameterType trial = parameters;
+    optimizerState opt;
+    ScoreLibrary(0, TotalHelices, trial, Lib, false);
+    opt.Lib = &Lib;
+    opt.TotalHelices = TotalHelices;
+    opt.delta = delta;
+    opt.maxDev = maxDev;
+    opt.allOffsets = false;
+    opt.quiet = true;
+    opt.sumSquaredDev = 0;
+    opt.acceptedDeviation.resize(TotalHelices);
+    for (short n=0;n<TotalHelices;n++)
+    {
+        opt.acceptedDeviation[n] = Lib[n].deviation;
+        opt.sumSquaredDev += Lib[n].deviation * Lib[n].deviation;
+    }
+    for (k=0;k<2;k++)
+    {
+        parameterType start = trial;
+        opt.trials = 0;
+        opt.helicesRescored = 0;
+        chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+        OptimizerRound(start, libraryIndex, opt, (k == 1));
+        seconds = SecondsSince(begin);
+        cout << "Optimizer round" << ((k == 1) ? " (parallel search): " : ": ") << seconds << " s, " << opt.trials << " trials, ";
+        cout << double(opt.helicesRescored) / TotalHelices << " library passes" << endl;
+        
+        // Back to the starting parameters for the next round.
+        ScoreLibrary(0, TotalHelices, trial, Lib, false);
+        for (short n=0;n<TotalHelices;n++) opt.acceptedDeviation[n] = Lib[n].deviation;
+        opt.sumSquaredDev = 0;
+        for (short n=0;n<TotalHelices;n++) opt.sumSquaredDev += Lib[n].deviation * Lib[n].deviation;
+    }
 }
 
-void ScoreLibrary (short start, short stop, parameterType parameters, TripleHelix * Lib)
+// // // // // // // // // // //
+// Validation
+// // // // // // // // // // //
+// The optimizer only reports how well the parameters fit the helices they were fitted to. ValidateFit fits them again,
+// as option (0) does, to parts of the training library and shows the error on the helices each fit did not see:
+// K-fold cross-validation (helix n is held out of fold n % K) and bootstrap resamples, whose out-of-bag helices are
+// held out. Every fit has its own copy of the parameters, its own helices and index, and the fits run side by side as
+// tasks of the scoring pool, which also does their rescoring.
+
+struct validationFit
 {
-    short n;
+    string          name;
+    vector<short>   training;       // helices of the library fitted to; a bootstrap sample may hold a helix more than once
+    vector<short>   heldOut;
+    parameterType   parameters;
+    short           rounds;
+    double          trainingMSD;    // average squared deviation of the training helices after the fit
+    double          heldOutRMSE;
+};
+
+// Fits start to the training helices of Library into fit.parameters and scores the held-out helices with the result.
+void RunValidationFit (const parameterType & start, HelixLibrary & Library, validationFit & fit, bool allOffsets, double delta, double maxDev, short maxRounds, bool parallelSearch)
+{
+    HelixLibrary Lib;
+    parameterType counts;
+    libraryIndexType index;
+    optimizerState opt;
+    short n, count = fit.training.size();
+    double sumSquaredDev = 0;
+    
+    for (n=0;n<count;n++) Lib.add() = Library[fit.training[n]];
+    CountInteractions(Lib, count, counts, &index, allOffsets);
+    fit.parameters = start;
+    fit.parameters.version = NextParameterVersion();
+    
+    ScoreLibrary(0, count, fit.parameters, Lib, allOffsets);
+    opt.Lib = &Lib;
+    opt.TotalHelices = count;
+    opt.delta = delta;
+    opt.maxDev = maxDev;
+    opt.allOffsets = allOffsets;
+    opt.quiet = true;
+    opt.sumSquaredDev = 0;
+    opt.acceptedDeviation.resize(count);
+    for (n=0;n<count;n++)
+    {
+        opt.acceptedDeviation[n] = Lib[n].deviation;
+        opt.sumSquaredDev += (Lib[n].deviation * Lib[n].deviation);
+    }
+    opt.trials = 0;
+    opt.helicesRescored = 0;
+    fit.rounds = FitParameters(fit.parameters, index, opt, maxRounds, parallelSearch);
+    fit.trainingMSD = opt.sumSquaredDev / count;
     
-    for (n=start;n<stop;n++)
+    for (n=0;n<(short)fit.heldOut.size();n++)
     {
-        ScoreHelix(parameters, &Lib[n]);
+        TripleHelix heldOut = Library[fit.heldOut[n]];
+        ScoreHelix(fit.parameters, &heldOut, allOffsets);
+        sumSquaredDev += heldOut.deviation * heldOut.deviation;
     }
+    fit.heldOutRMSE = 0;
+    if (fit.heldOut.size() > 0) fit.heldOutRMSE = sqrt(sumSquaredDev / fit.heldOut.size());
 }
 
-void pause (double wait)
+// The mean and standard deviation of the held-out RMSE of fits first ... last-1.
+void ShowValidationSummary (const vector<validationFit> & fits, short first, short last, string name)
 {
-    time_t t;
-    t = clock();
-    while ((double(clock() - t)) < wait)
+    double sum = 0, sumSquares = 0;
+    short k;
+    
+    if (last <= first) return;
+    for (k=first;k<last;k++)
     {
-        // do nothing
+        sum += fits[k].heldOutRMSE;
+        sumSquares += fits[k].heldOutRMSE * fits[k].heldOutRMSE;
     }
+    double mean = sum / (last - first);
+    double spread = sqrt(max(0.0, sumSquares / (last - first) - mean*mean));
+    cout << name << ": held-out RMSE = " << mean << " +/- " << spread << " over " << last - first << " fits." << endl;
 }
 
-short readLibrary (TripleHelix * Lib, string Lib_Name)
+// folds-fold cross-validation (none if folds < 2) followed by samples bootstrap resamples, all fitted side by side.
+// Shows each fit, the held-out error and how much each optimized value moves between the fits.
+void ValidateFit (const parameterType & parameters, HelixLibrary & Library, short TotalHelices, short folds, short samples, bool allOffsets, double delta, double maxDev, short maxRounds, bool parallelSearch)
 {
-    short x, y, n;
+    const short mostVariable = 10;  // how many of the values that move most are shown
+    vector<validationFit> fits;
+    short k, n;
     
-    short TotalHelices = 0;
-    string killString;
-    string seqDate;
-    char peptideInput[100]; // holds the peptide sequences as they are input
-    ifstream seq_input(Lib_Name);
+    if (folds >= 2) for (k=0;k<folds;k++)
+    {
+        validationFit fit;
+        fit.name = "Fold " + to_string(k+1) + " of " + to_string(folds);
+        for (n=0;n<TotalHelices;n++)
+        {
+            if ((n % folds) == k) fit.heldOut.push_back(n);
+            else fit.training.push_back(n);
+        }
+        fits.push_back(fit);
+    }
+    short numFolds = fits.size();
+    for (k=0;k<samples;k++)
+    {
+        validationFit fit;
+        mt19937 generator(k+1);
+        vector<bool> drawn(TotalHelices, false);
+        fit.name = "Bootstrap " + to_string(k+1) + " of " + to_string(samples);
+        for (n=0;n<TotalHelices;n++)
+        {
+            short helix = generator() % TotalHelices;
+            fit.training.push_back(helix);
+            drawn[helix] = true;
+        }
+        for (n=0;n<TotalHelices;n++) if (not drawn[n]) fit.heldOut.push_back(n);
+        fits.push_back(fit);
+    }
+    if (fits.size() == 0) return;
     
-    if (!seq_input.is_open())
+    cout << "Fitting " << fits.size() << " parameter sets side by side on " << ScoringPool().workers.size() << " scoring threads." << endl;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    ScoringPool().Run(fits.size(), [&] (long item) { RunValidationFit(parameters, Library, fits[item], allOffsets, delta, maxDev, maxRounds, parallelSearch); });
+    cout << "Done in " << SecondsSince(start) << " s." << endl << endl;
+    
+    for (k=0;k<(short)fits.size();k++)
     {
-        cout << "We couldn't open the seq_input.txt file." << endl;
-        return 0;
+        cout << fits[k].name << ": " << fits[k].training.size() << " helices fitted in " << fits[k].rounds << " rounds, Avg of SSDev = " << fits[k].trainingMSD;
+        cout << ". " << fits[k].heldOut.size() << " held out, RMSE = " << fits[k].heldOutRMSE << endl;
     }
-    getline (seq_input, seqDate);
-    cout << "Sequence Library: " << seqDate << endl;
-    seq_input >> TotalHelices; // indicates the total number of helices to be expected from the text file input
+    cout << endl;
+    ShowValidationSummary(fits, 0, numFolds, "Cross-validation");
+    ShowValidationSummary(fits, numFolds, fits.size(), "Bootstrap");
     
-    x = 0;
-    n = 0; // n tracks the triple helix we are evaluating.
-    for (n=0; n<(TotalHelices); n++)
+    // How far each optimized value ends up apart across the fits.
+    struct valueSpread
+    {
+        string  name;
+        double  mean, spread;
+    };
+    vector<valueSpread> values;
+    const string kindName[4] = {"Xaa", "Yaa", "axial", "lateral"};
+    for (short kind=0;kind<4;kind++) for (short x=0;x<27;x++) for (short y=0;y<((kind < 2) ? 1 : 27);y++)
+    {
+        bool optimized = ((kind == 0) && parameters.optPropX[x]) || ((kind == 1) && parameters.optPropY[x]) || ((kind == 2) && parameters.optAxial[x][y]) || ((kind == 3) && parameters.optLat[x][y]);
+        if (not optimized) continue;
+        double sum = 0, sumSquares = 0;
+        for (k=0;k<(short)fits.size();k++)
+        {
+            double value = ParameterValue(fits[k].parameters, kind, x, y);
+            sum += value;
+            sumSquares += value * value;
+        }
+        valueSpread value;
+        value.name = kindName[kind] + char(x+64);
+        if (kind >= 2) value.name += string(",") + char(y+64);
+        value.mean = sum / fits.size();
+        value.spread = sqrt(max(0.0, sumSquares / fits.size() - value.mean*value.mean));
+        values.push_back(value);
+    }
+    stable_sort(values.begin(), values.end(), [] (const valueSpread & first, const valueSpread & second) { return first.spread > second.spread; });
+    double sumSpread = 0;
+    for (k=0;k<(short)values.size();k++) sumSpread += values[k].spread;
+    if (values.size() > 0) cout << "Optimized values: " << values.size() << ", average standard deviation across the fits = " << sumSpread / values.size() << endl;
+    for (k=0;(k<mostVariable) && (k<(short)values.size());k++) cout << values[k].name << "\t" << values[k].mean << " +/- " << values[k].spread << endl;
+}
+
+// // // // // // // // // // //
+// Command line
+// // // // // // // // // // //
+// Everything main would ask on the standard input can be given on the command line instead, so runs can be scripted
+// and run side by side without a terminal. Options that are left out keep the settings at the top of main.
+struct commandLine
+{
+    bool            help = false;
+    short           useCase = -1;       // --mode; -1 asks as before
+    string          trainingLibrary = "seq_input.txt";
+    string          userLibrary = "user_lib.txt";
+    string          parameterFile = "parameters.txt";
+    string          experimentalFile = "parameters_exp.txt";
+    string          optimizationFile = "opt_list.txt";
+    string          output = "";        // --output; "" keeps libraryOutput
+    short           format = -1;        // --format as an outputFormat; -1 keeps libraryFormat
+    short           threads = -1;       // --threads; -1 keeps scoringThreads
+    bool            allOffsets = false;
+    bool            binaryInput = false;
+    bool            parallelSearch = false;
+    bool            gradientFit = false;
+    bool            cache = false;
+    bool            noCache = false;
+    bool            fullTables = false;
+    bool            confidence = false;
+    short           scan = 0;           // --scan; how many of the best substitutions --mode helix shows, 0 for no scan
+    short           beam = -1;          // --beam; -1 keeps designBeam
+    short           top = -1;           // --top; -1 keeps designTop
+    short           folds = -1;         // --folds; -1 keeps validationFolds
+    short           bootstrap = -1;     // --bootstrap; -1 keeps bootstrapSamples
+    string          socket = "";        // --socket; "" has --mode serve answer on the standard output
+    string          profile = "";       // --profile; text or json, for builds with SCEPTTR_PROFILE
+    string          Nterm = "ac";
+    string          Cterm = "am";
+    vector<string>  peptides;           // --peptide, 1-3 of them, for --mode helix (2-3 for --mode design)
+    vector<string>  parameterSets;      // --set, more parameter files for --mode compare
+};
+
+void PrintUsage (void)
+{
+    cout << "Options:" << endl;
+    cout << "  --mode M             run without the menu. M is optimize (0), helix (1), library (2), check (3), convert (4), design (5), benchmark (6), compare (7), validate (8) or serve (9)." << endl;
+    cout << "  --training FILE      training library (seq_input.txt)" << endl;
+    cout << "  --lib FILE           user library scored by --mode library (user_lib.txt)" << endl;
+    cout << "  --params FILE        parameters (parameters.txt)" << endl;
+    cout << "  --exp-params FILE    experimental parameters (parameters_exp.txt)" << endl;
+    cout << "  --opt-list FILE      parameters to optimize (opt_list.txt)" << endl;
+    cout << "  --output FILE        where --mode library (or compare) writes its records, - for the standard output" << endl;
+    cout << "  --format F           csv, json, binary or console (the colored view) for --mode library" << endl;
+    cout << "  --threads N          number of scoring threads, 0 for one per hardware thread" << endl;
+    cout << "  --all-offsets        also score the eight non-canonical offsets" << endl;
+    cout << "  --binary             read the .bin files written by --mode convert in place of the text files" << endl;
+    cout << "  --parallel-search    --mode optimize tries every parameter at once each round" << endl;
+    cout << "  --gradient-fit       --mode optimize fits all parameters at once on the linearized Tm" << endl;
+    cout << "  --scan N             --mode helix also tries every single substitution and shows the best N by Tm, specificity and CCTm" << endl;
+    cout << "  --beam N             how many partial designs --mode design keeps per position" << endl;
+    cout << "  --top N              how many of the most specific designs --mode design keeps and shows" << endl;
+    cout << "  --folds K            --mode validate fits K times, each time holding out every K-th helix (0 for none)" << endl;
+    cout << "  --bootstrap B        --mode validate also fits B bootstrap resamples, holding out the helices not drawn" << endl;
+    cout << "  --socket NAME        --mode serve listens on this Unix domain socket. Without it requests are read from the standard input and answered on the standard output, and everything else is shown on the standard error" << endl;
+    cout << "  --cache              also remember scored registers between helices in --mode library and serve" << endl;
+    cout << "  --no-cache           don't remember scored registers between helices, not even in --mode helix" << endl;
+    cout << "  --full-tables        score every register even where only the best, second best and correct ones are used (--mode optimize, validate, serve and library records)" << endl;
+    cout << "  --confidence         the csv and json records of --mode library and serve also give the number of low confidence interactions of each helix" << endl;
+    cout << "  --peptide SEQ        a peptide of the helix scored by --mode helix, given 1-3 times, or the start of --mode design, given 2-3 times" << endl;
+    cout << "  --set FILE           --mode compare also scores the training library with this parameter file, given any number of times" << endl;
+    cout << "  --nterm T, --cterm T termination of that helix: n / ac (default) and c / am (default)" << endl;
+    cout << "  --profile F          at the end write how long each phase took, as text or json, to the standard error (builds with -DSCEPTTR_PROFILE)" << endl;
+    cout << "  --help               show this list" << endl;
+}
+
+// Returns false, after saying why, if the command line can't be used.
+bool ParseCommandLine (int argc, const char * argv[], commandLine & options)
+{
+    short k;
+    
+    for (k=1;k<argc;k++)
     {
-        x = 0;
-        seq_input >> Lib[n].numPep;
-        while (Lib[n].numPep == 0)
+        string option = argv[k];
+        bool needsValue = (option != "--help") && (option != "--all-offsets") && (option != "--binary") && (option != "--parallel-search") && (option != "--gradient-fit") && (option != "--cache") && (option != "--no-cache") && (option != "--full-tables") && (option != "--confidence");
+        if (needsValue && ((k+1) >= argc))
+        {
+            cout << option << " needs a value." << endl;
+            return false;
+        }
+        string value = "";
+        if (needsValue) value = argv[++k];
+        
+        if (option == "--help") options.help = true;
+        else if (option == "--all-offsets") options.allOffsets = true;
+        else if (option == "--binary") options.binaryInput = true;
+        else if (option == "--parallel-search") options.parallelSearch = true;
+        else if (option == "--gradient-fit") options.gradientFit = true;
+        else if (option == "--cache") options.cache = true;
+        else if (option == "--no-cache") options.noCache = true;
+        else if (option == "--full-tables") options.fullTables = true;
+        else if (option == "--confidence") options.confidence = true;
+        else if (option == "--mode")
         {
-            getline(seq_input, killString);
-            seq_input >> Lib[n].numPep;
-            //cout << n << " " << x << " " << killString << endl;
-            x++;
-            if (x>50)
+            const string modes[10] = {"optimize", "helix", "library", "check", "convert", "design", "benchmark", "compare", "validate", "serve"};
+            for (short m=0;m<10;m++) if ((value == modes[m]) || (value == to_string(m))) options.useCase = m;
+            if (options.useCase < 0)
             {
-                cout << "Problem reading " << Lib_Name << ". Likely problem: is either 1) indicated number of helices exceeds actual number of helices or 2) with commenting." << endl;
-                return 0;
+                cout << "Unknown mode " << value << "." << endl;
+                return false;
             }
         }
-        x = 0;
-        if ((Lib[n].numPep < 1) || (Lib[n].numPep>3))
+        else if (option == "--training") options.trainingLibrary = value;
+        else if (option == "--lib") options.userLibrary = value;
+        else if (option == "--params") options.parameterFile = value;
+        else if (option == "--exp-params") options.experimentalFile = value;
+        else if (option == "--opt-list") options.optimizationFile = value;
+        else if (option == "--output") options.output = value;
+        else if (option == "--format")
         {
-            cout << "Number of unique peptides in a helix must be 1-3. Value read was Library[" << n << "].numPep = " << Lib[n].numPep << ". Stopping now." <<endl;
-            Lib[n-1].dissect();
-            Lib[n].dissect();
-            return 0;
+            if (value == "csv") options.format = csvOutput;
+            else if (value == "json") options.format = jsonOutput;
+            else if (value == "binary") options.format = binaryOutput;
+            else if (value == "console") options.format = consoleOutput;
+            else
+            {
+                cout << "Unknown format " << value << "." << endl;
+                return false;
+            }
         }
-
-        seq_input >> Lib[n].numAA;
-        
-        if ((Lib[n].numAA < 21) || (Lib[n].numAA>48))
+        else if (option == "--scan")
         {
-            cout << "Number of amino acids in the peptide must be 21-48. Value read was Library[" << n << "].numAA = " << Lib[n].numAA  << ". Stopping now." <<endl;
-            Lib[n-1].dissect();
-            Lib[n].dissect();
-            return 0;
+            options.scan = atoi(value.c_str());
+            if ((options.scan <= 0) || (value.find_first_not_of("0123456789") != string::npos))
+            {
+                cout << "--scan needs a number." << endl;
+                return false;
+            }
         }
-        
-        seq_input >> Lib[n].Nterm;
-        seq_input >> Lib[n].Cterm;
-        seq_input >> Lib[n].expTm;
-                
-        for (x=0; x<Lib[n].numPep; x++)
+        else if ((option == "--beam") || (option == "--top"))
+        {
+            short number = atoi(value.c_str());
+            if ((number <= 0) || (value.find_first_not_of("0123456789") != string::npos))
+            {
+                cout << option << " needs a number." << endl;
+                return false;
+            }
+            if (option == "--beam") options.beam = number; else options.top = number;
+        }
+        else if ((option == "--folds") || (option == "--bootstrap"))
+        {
+            short number = atoi(value.c_str());
+            if ((value.size() == 0) || (value.find_first_not_of("0123456789") != string::npos))
+            {
+                cout << option << " needs a number." << endl;
+                return false;
+            }
+            if (option == "--folds") options.folds = number; else options.bootstrap = number;
+        }
+        else if (option == "--threads")
+        {
+            options.threads = atoi(value.c_str());
+            if ((options.threads < 0) || (value.find_first_not_of("0123456789") != string::npos))
+            {
+                cout << "--threads needs a number." << endl;
+                return false;
+            }
+        }
+        else if (option == "--nterm") options.Nterm = value;
+        else if (option == "--cterm") options.Cterm = value;
+        else if (option == "--peptide") options.peptides.push_back(value);
+        else if (option == "--set") options.parameterSets.push_back(value);
+        else if (option == "--socket") options.socket = value;
+        else if (option == "--profile")
         {
-            for (y=0;y<Lib[n].numAA;y++)
+            if ((value != "text") && (value != "json"))
             {
-                seq_input >> peptideInput[y];
-                Lib[n].sequences[x][y] = toupper(peptideInput[y]);
+                cout << "--profile is text or json." << endl;
+                return false;
             }
+            options.profile = value;
+        }
+        else
+        {
+            cout << "Unknown option " << option << "." << endl;
+            return false;
         }
     }
-    seq_input.close();
-    
-    // Determine Xaa, Yaa and Gly positions (reptition)
-    for (n=0; n<(TotalHelices); n++) Lib[n].determine_reptition();
-        
-    
-    
     
-    
-    
-    
-    return TotalHelices;
+    if (options.peptides.size() > 3)
+    {
+        cout << "A helix has at most 3 distinct peptides." << endl;
+        return false;
+    }
+    for (k=0;k<(short)options.peptides.size();k++)
+    {
+        if ((options.peptides[k].size() < 21) || (options.peptides[k].size() > 48) || (options.peptides[k].size() != options.peptides[0].size()))
+        {
+            cout << "Every peptide must have the same number of amino acids, 21-48." << endl;
+            return false;
+        }
+    }
+    if ((options.useCase == 1) && (options.peptides.size() == 0))
+    {
+        cout << "--mode helix needs at least one --peptide." << endl;
+        return false;
+    }
+    if ((options.useCase == 5) && (options.peptides.size() < 2))
+    {
+        cout << "--mode design needs two or three --peptide." << endl;
+        return false;
+    }
+    return true;
 }
 
 // // // // // // // // // // //
@@ -1473,10 +6084,72 @@ short readLibrary (TripleHelix * Lib, string Lib_Name)
 // // // // // // // // // // //
 int main (int argc, const char * argv[])
 {
+    // Set to true to also score the eight non-canonical offsets (staggers) of every composition.
+    bool allOffsets = false;
+    // Set to true to read parameters.bin, seq_input.bin and user_lib.bin (written by option 4) in place of the text files.
+    bool binaryInput = false;
+    // How option (2) reports user_lib.txt: one record per helix as csvOutput, jsonOutput or binaryOutput, or the colored per-helix view (consoleOutput).
+    outputFormat libraryFormat = csvOutput;
+    // Where the records go. Empty for user_lib_scores.csv / .jsonl / .bin, "-" for the standard output.
+    string libraryOutput = "";
+    // Set to true to remember scored registers and threads across helices (scoreCache) in option (1), where edits
+    // score the same helix again and again.
+    bool cacheScores = true;
+    // Set to true to also use scoreCache in options (2) and (9). ScoreEntries already shares duplicate entries and the
+    // threads of shared peptide pairs there, so the cache rarely hits and its lookups only slow the workers down.
+    bool cacheLibraries = false;
+    // Set to false to score every register where only the best, second best and correct ones are used: the optimizer's
+    // rounds and options (2) (other than the colored view), (8) and (9). See topTwoScoring.
+    bool rankedScoring = true;
+    // Set to true to give the number of low confidence interactions of each helix in the records of options (2) and (9).
+    bool confidenceRecords = false;
+    // Option (5): how many partial designs are kept per design position, and how many of the most specific designs are kept.
+    short designBeam = 32;
+    short designTop = 10;
+    // Option (8): the number of cross-validation folds (0 for none) and of bootstrap resamples fitted.
+    short validationFolds = 10;
+    short bootstrapSamples = 0;
+    
+    commandLine options;
+    if (not ParseCommandLine(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+    if (options.help)
+    {
+        PrintUsage();
+        return 0;
+    }
+    // --mode serve answers on the standard output unless it has a socket, so then everything else goes to the standard error.
+    streambuf * answerOutput = cout.rdbuf();
+    if ((options.useCase == 9) && (options.socket == "")) cout.rdbuf(cerr.rdbuf());
     cout << "-------------------------------------------" << endl;
     cout << "SCEPTTr" << endl;
+    if (options.allOffsets) allOffsets = true;
+    if (options.binaryInput) binaryInput = true;
+    if (options.format >= 0) libraryFormat = (outputFormat)options.format;
+    if (options.output != "") libraryOutput = options.output;
+    if (options.threads >= 0) scoringThreads = options.threads;
+    if (options.noCache) cacheScores = false;
+    if (options.cache) cacheLibraries = true;
+    if (options.fullTables) rankedScoring = false;
+    if (options.confidence) confidenceRecords = true;
+    if (options.beam > 0) designBeam = options.beam;
+    if (options.top > 0) designTop = options.top;
+    if (options.folds >= 0) validationFolds = options.folds;
+    if (options.bootstrap >= 0) bootstrapSamples = options.bootstrap;
+#ifdef SCEPTTR_PROFILE
+    profiler.format = options.profile;
+#else
+    if (options.profile != "") cout << "This build has no profiling counters (build with -DSCEPTTR_PROFILE), so --profile is ignored." << endl;
+#endif
+    // The optimizer only runs when asked for on the command line.
+    bool allowOptimization = (options.useCase == 0);
+    
     cout << "v1.2 BETA 2021-09-23" << endl;
-    cout << "Only canonical compositions/registers examined!" << endl;
+    if (allOffsets) cout << "All nine offsets of every composition examined." << endl;
+    else cout << "Only canonical compositions/registers examined!" << endl;
     cout << "Based in part on previously published" << endl;
     cout << "SCEPTTr 1.0 and 1.1" <<endl;
     cout << "-------------------------------------------" << endl;
@@ -1488,19 +6161,17 @@ int main (int argc, const char * argv[])
     
     
     
-    TripleHelix Library[500]; // Holds results for all triple helices in the library. Maybe make this dynamic based on read input.
+    HelixLibrary Library; // Holds results for all triple helices in the library. Grows as the library is read.
     TripleHelix userHelix;
-    TripleHelix userLib[100];
     
     short TotalHelices=0; // This is the total number of helices that will be evaluated from the read-in text file.
-    short totalUserHelices = 0;
+    long totalUserHelices = 0;
     
     // various counters
     short n=0, x=0, y=0;
     //short xCount, yCount, zCount;
     
     double sumSquaredDev = 0;
-    double NewSumSquaredDev = 0;
     
     
     
@@ -1513,12 +6184,25 @@ int main (int argc, const char * argv[])
     // This is the maximum number of improvement rounds that will be tried before stopping.
     short maxRounds = 25;
     
+    // Set to true to try every parameter at once each round (ParallelSearchRound) rather than one after another.
+    bool parallelSearch = false;
+    if (options.parallelSearch) parallelSearch = true;
+    
+    // Set to true to fit every parameter at once on the linearized Tm (GradientFit) in place of the rounds above.
+    bool gradientFit = false;
+    if (options.gradientFit) gradientFit = true;
+    // The most steps the fit takes. Each step scores the library once or twice.
+    short maxFitSteps = 50;
+    
     // During the optimization this is the largest a value can deviate from experimental parameters.
     double maxDev = 2.0; // negative number should make it impossible to make changes...
     
     // This struct holds all the parameters that are read from file.
     parameterType parameters;
     parameterType countInteractions;
+    libraryIndexType libraryIndex;
+    interactionIndex interactions;
+    short a;
     //parameterType expVal;
     
     // These booleans are used to decide if a parameter should
@@ -1529,46 +6213,68 @@ int main (int argc, const char * argv[])
     short worstHelix = -1;
     double worstDeviation = -1;
     bool done = false;
-    short round = 0;
-    bool improved = false;
-    short useCase = 3;
+    short useCase = -1;
     
     // // // // // // // // // // //
     // READ INITIAL PARAMETERS HERE
     // // // // // // // // // // //
-    parameters = ReadParameters();
+    if ((not binaryInput) || (not ReadBinaryParameters(parameters, BinaryName(options.parameterFile)))) parameters = ReadParameters(options.parameterFile, options.experimentalFile, options.optimizationFile);
     // DisplayParameters(parameters);
     
     
     
+    // cout << "Do you want to (0) optimize parameters against the existing peptide library, (1) manually enter the parameters for a new helix or (2) evaluate user_lib.txt?" << endl;
+    useCase = options.useCase;
+    if (useCase < 0) cout << "Do you want to (1) manually enter the parameters for a new helix, (2) evaluate user_lib.txt, (3) check the pairwise solver against seq_input.txt, (4) convert the parameter and library files to binary, (5) search for more specific designs of a new heterotrimer, (6) time the scoring and the optimizer, (7) compare parameter sets on seq_input.txt, (8) cross-validate the optimizer on seq_input.txt or (9) score helices sent on the standard input until it ends?" << endl;
+    while ((useCase != 0) && (useCase != 1) && (useCase != 2) && (useCase != 3) && (useCase != 4) && (useCase != 5) && (useCase != 6) && (useCase != 7) && (useCase != 8) && (useCase != 9))
+    {
+        cin >> useCase;
+    }
+    
     // // // // // // // // // // //
     // READ PEPTIDE SEQUENCES HERE
     // // // // // // // // // // //
+    // Only read when needed: for the optimizer and the other options working on the training library, and for the
+    // low confidence interactions of option (1) and of the records of (2) and (9) with confidenceRecords, unless the
+    // interaction counts written by option (4) can be read. Options (2), (5) and (9) otherwise only score new helices.
+    bool needsConfidence = (useCase == 1) || (confidenceRecords && ((useCase == 2) || (useCase == 9)));
+    bool countsRead = needsConfidence && binaryInput && ReadInteractionCounts(interactions, CountsName(options.trainingLibrary));
+    bool needsTraining = (useCase != 1) && (useCase != 2) && (useCase != 5) && (useCase != 9);
+    if (needsConfidence && (not countsRead)) needsTraining = true;
     
-    for (x=0;x<500;x++) Library[x].initializeAll();
-    
+    TotalHelices = needsTraining ? -1 : 0; // an empty library has no interactions to count below
+    if (needsTraining && binaryInput) TotalHelices = readBinaryLibrary(Library, BinaryName(options.trainingLibrary));
+    if (TotalHelices < 0) TotalHelices = readLibrary(Library, options.trainingLibrary);
     
-    TotalHelices = readLibrary(Library, "seq_input.txt");
-    
-    cout << "TotalHelices in training library = " << TotalHelices << endl;
-    if (TotalHelices == 0)
+    if (needsTraining) cout << "TotalHelices in training library = " << TotalHelices << endl;
+    if (needsTraining && (TotalHelices == 0))
     {
         cout << "TotalHelices in training library = " << TotalHelices << ". Stopping." << endl;
         return 0;
     }
     
-    // cout << "Do you want to (0) optimize parameters against the existing peptide library, (1) manually enter the parameters for a new helix or (2) evaluate user_lib.txt?" << endl;
-    cout << "Do you want to (1) manually enter the parameters for a new helix or (2) evaluate user_lib.txt?" << endl;
-    while ((useCase != 0) && (useCase != 1) && (useCase != 2))
-    {
-        cin >> useCase;
-    }
-    
     //useCase = 1;
+    if (cacheScores && ((useCase == 1) || (cacheLibraries && ((useCase == 2) || (useCase == 9))))) scoreCache.enabled = true;
+    if (rankedScoring && (((useCase == 2) && (libraryFormat != consoleOutput)) || (useCase == 8) || (useCase == 9))) topTwoScoring = true;
     
     // useCase = 1;
     // Ask user for sequence information
-    if (useCase == 1)
+    if (((useCase == 1) || (useCase == 5)) && (options.peptides.size() > 0))
+    {
+        userHelix.numPep = options.peptides.size();
+        userHelix.numAA = options.peptides[0].size();
+        userHelix.Nterm = options.Nterm;
+        userHelix.Cterm = options.Cterm;
+        for (x=0; x<userHelix.numPep; x++)
+        {
+            for (y=0;y<userHelix.numAA;y++)
+            {
+                userHelix.sequences[x][y] = toupper(options.peptides[x][y]);
+            }
+        }
+        userHelix.determine_reptition();
+    }
+    else if ((useCase == 1) || (useCase == 5))
     {
         cout << "How many distinct peptides are in your helix? (1) Homotrimer, (2) A2B Heterotrimer, or (3) ABC Heterotrimer?" << endl;
         cin >> userHelix.numPep;
@@ -1614,49 +6320,11 @@ int main (int argc, const char * argv[])
     // At this point we have declared our variables, read our parameters and sequences. Next evaluate the training library.
     // // // // // // // // //
     
-    // Count of all Xaa, Yaa and pairwise interactions possible in canonical registers for this library
-    // Zero interactions
-    for (y=0;y<27;y++)
-    {
-        countInteractions.propensityX[y] = 0;
-        countInteractions.propensityY[y] = 0;
-        for (x=0;x<27;x++)
-        {
-            countInteractions.lateral[y][x] = 0;
-            countInteractions.axial[y][x] = 0;
-        }
-    }
-    
-    // Count interactions
-    short a,b,c;
-    for (n=0; n<TotalHelices; n++) // doesn't look at the user's helix.
-    {
-        for (a=0;a<Library[n].numPep;a++)
-        {
-            for (x=0;x<Library[n].numAA;x++)
-            {
-                if (Library[n].isXaa(x)) countInteractions.propensityX[short(Library[n].sequences[a][x])-64]++;
-                if (Library[n].isYaa(x)) countInteractions.propensityY[short(Library[n].sequences[a][x])-64]++;
-            }
-            for (b=0;b<Library[n].numPep;b++)for (c=0;c<Library[n].numPep;c++)
-            {
-                for (x=0;x<Library[n].numAA;x++)
-                {
-                    if (Library[n].isYaa(x))
-                    {
-                        if ((x+2) < Library[n].numAA) countInteractions.axial[short(Library[n].sequences[a][x])-64][short(Library[n].sequences[b][x+2])-64]++;
-                        if ((x+2) < Library[n].numAA) countInteractions.axial[short(Library[n].sequences[b][x])-64][short(Library[n].sequences[c][x+2])-64]++;
-                        if ((x+5) < Library[n].numAA) countInteractions.axial[short(Library[n].sequences[c][x])-64][short(Library[n].sequences[a][x+5])-64]++;
-                    
-                        if (x>1) countInteractions.lateral[short(Library[n].sequences[a][x])-64][short(Library[n].sequences[b][x-1])-64]++;
-                        if (x>1) countInteractions.lateral[short(Library[n].sequences[b][x])-64][short(Library[n].sequences[c][x-1])-64]++;
-                        if ((x+2) < Library[n].numAA) countInteractions.lateral[short(Library[n].sequences[c][x])-64][short(Library[n].sequences[a][x+2])-64]++;
-                    }
-                }
-            }
-        }
-    }
-    
+    // Count of all Xaa, Yaa and pairwise interactions possible in canonical registers for this library,
+    // and the index of which helices use each parameter.
+    CountInteractions(Library, TotalHelices, countInteractions, &libraryIndex, allOffsets);
+    if (not countsRead) IndexInteractions(countInteractions, interactions);
+
     // Set optimization by counts.
     for (y=0;y<27;y++)
     {
@@ -1730,10 +6398,7 @@ int main (int argc, const char * argv[])
         worstDeviation = -1;
         double sumDeviation = 0;
         
-        thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-        thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-        th1.join();
-        th2.join();
+        ScoreLibrary(0, TotalHelices, parameters, Library, allOffsets);
         for (n=0; n<(TotalHelices); n++)
         {
             sumDeviation += Library[n].deviation;
@@ -1771,20 +6436,35 @@ int main (int argc, const char * argv[])
         cout << "Initial sumSquaredDev = " << sumSquaredDev << ". Average sumSquaredDev = " << sumSquaredDev / TotalHelices << endl;
         cout << "Starting Optimization." << endl;
         cout << endl;
+        // The helices shown above needed their whole tables; from here on only their ranking is used.
+        topTwoScoring = rankedScoring;
         //cout << endl << "Last Helix in Library: " << TotalHelices << endl;
         
         
         
-        NewSumSquaredDev = 0;
+        // Trials rescore only the helices that use the parameter being changed (see libraryIndex).
+        optimizerState opt;
+        opt.Lib = &Library;
+        opt.TotalHelices = TotalHelices;
+        opt.delta = delta;
+        opt.maxDev = maxDev;
+        opt.allOffsets = allOffsets;
+        opt.quiet = false;
+        opt.sumSquaredDev = sumSquaredDev;
+        opt.acceptedDeviation.resize(TotalHelices);
+        for (n=0; n<TotalHelices; n++) opt.acceptedDeviation[n] = Library[n].deviation;
+        opt.trials = 0;
+        opt.helicesRescored = 0;
+        
         done = false;
-        round = 0;
-        improved = false;
-        bool improvedRound = false;
-        done = true; // ie don't make changes! Comment this out to allow optimization.
+        if (not allowOptimization) done = true; // ie don't make changes! Run with --mode optimize to allow optimization.
         
         cout << "Maximum Deviation from Experimental Values = " << maxDev << endl;
         cout << "delta (change per test) = " << delta << endl;
         cout << "Max Rounds = " << maxRounds << endl;
+        cout << "Scoring threads = " << ScoringPool().workers.size() << endl;
+        if (parallelSearch) cout << "Parallel line search: the largest non-overlapping improvements are kept each round." << endl;
+        if (gradientFit) cout << "Gradient fit: all parameters are fitted at once on the linearized Tm, at most " << maxFitSteps << " steps." << endl;
         cout << endl;
         
         
@@ -1792,394 +6472,20 @@ int main (int argc, const char * argv[])
         
         time = clock();
         
-        
-        while (not done)
-        {
-        // // // // // // // //
-        // Now optimize parameters where possible.
-        // // // // // // // //
+        if (gradientFit && (not done))
         {
-        // LENGTH PARAMETERS //
-        /* for now, don't try to optimize these since we don't have a lot of different sized peptides in our library. Mostly just 24 & 30 aa peptides.
-            // // //
-            // A  //
-            // // //
-            parameters.A -= 0.01;
-            NewSumSquaredDev = 0;
-            for (n=0; n<TotalHelices; n++)
-            {
-                Library[n] = ScoreHelix (parameters, Library[n]);
-                NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-            }
-            if (NewSumSquaredDev < sumSquaredDev)
-            {
-                // keep this new parameter and move on.
-                cout << "A-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
-                sumSquaredDev = NewSumSquaredDev;
-                improved = true;
-            }
-            else
-            {
-                parameters.A += 0.02;
-                NewSumSquaredDev = 0;
-                for (n=0; n<TotalHelices; n++)
-                {
-                    Library[n] = ScoreHelix (parameters, Library[n]);
-                    NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                }
-                if (NewSumSquaredDev < sumSquaredDev)
-                {
-                    // keep this new parameter and move on.
-                    cout << "A-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
-                    sumSquaredDev = NewSumSquaredDev;
-                    improved = true;
-                }
-                else
-                {
-                    // neither change resulted in an improvement. Go back to original parameter.
-                    parameters.A -= 0.01;
-                }
-            }
-        
-            // // //
-            // B  //
-            // // //
-            parameters.B -= 0.002;
-            NewSumSquaredDev = 0;
-            for (n=0; n<TotalHelices; n++)
-            {
-                Library[n] = ScoreHelix (parameters, Library[n]);
-                NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-            }
-            if (NewSumSquaredDev < sumSquaredDev)
-            {
-                // keep this new parameter and move on.
-                cout << "B-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
-                sumSquaredDev = NewSumSquaredDev;
-                improved = true;
-            }
-            else
-            {
-                parameters.B += 0.004;
-                NewSumSquaredDev = 0;
-                for (n=0; n<TotalHelices; n++)
-                {
-                    Library[n] = ScoreHelix (parameters, Library[n]);
-                    NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                }
-                if (NewSumSquaredDev < sumSquaredDev)
-                {
-                    // keep this new parameter and move on.
-                    cout << "B-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
-                    sumSquaredDev = NewSumSquaredDev;
-                    improved = true;
-                }
-                else
-                {
-                    // neither change resulted in an improvement. Go back to original parameter.
-                    parameters.B -= 0.002;
-                }
-            }
+            short steps = GradientFit(parameters, opt, maxFitSteps);
+            sumSquaredDev = opt.sumSquaredDev;
+            cout << "Gradient fit kept " << steps << " steps. Avg of SSDev = " << sumSquaredDev / TotalHelices << endl;
+            cout << opt.trials << " steps rescored " << opt.helicesRescored << " helices (" << double(opt.helicesRescored) / TotalHelices << " library passes)." << endl << endl;
+            done = true;
+        }
         
-            // // //
-            // C  //
-            // // //
-            parameters.C -= 0.0002;
-            NewSumSquaredDev = 0;
-            for (n=0; n<TotalHelices; n++)
-            {
-                Library[n] = ScoreHelix (parameters, Library[n]);
-                NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-            }
-            if (NewSumSquaredDev < sumSquaredDev)
-            {
-                // keep this new parameter and move on.
-                cout << "C-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
-                sumSquaredDev = NewSumSquaredDev;
-                improved = true;
-            }
-            else
-            {
-                parameters.C += 0.0004;
-                NewSumSquaredDev = 0;
-                for (n=0; n<TotalHelices; n++)
-                {
-                    Library[n] = ScoreHelix (parameters, Library[n]);
-                    NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                }
-                if (NewSumSquaredDev < sumSquaredDev)
-                {
-                    // keep this new parameter and move on.
-                    cout << "C-length. New SSD: " << NewSumSquaredDev << ". Old SSD: " << sumSquaredDev << endl;
-                    sumSquaredDev = NewSumSquaredDev;
-                    improved = true;
-                }
-                else
-                {
-                    // neither change resulted in an improvement. Go back to original parameter.
-                    parameters.C -= 0.0002;
-                }
-            }
-            */
-        } // hidden length optimization which we are not doing at the moment.
-            
-        for (x=0;x<27;x++)
+        if (not done)
         {
-            if (parameters.optPropX[x])
-            {
-                parameters.propensityX[x] -= delta;
-                NewSumSquaredDev = 0;
-                if (parameters.propensityX[x] >= (parameters.exPropensityX[x] - maxDev)) // Only test this optimization if we are in range (2) of experimental values.
-                {
-                    thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-                    thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-                    th1.join();
-                    th2.join();
-                    for (n=0; n<TotalHelices; n++)
-                    {
-                        //ScoreHelix(parameters, &Library[n]);
-                        //cout << n << " ";
-                        NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                        //if (abs(Library[n].deviation) > 1) NewSumSquaredDev += (abs(Library[n].deviation)-1);
-                    }
-                    //cout << endl;
-                    if (NewSumSquaredDev < sumSquaredDev)
-                    {
-                        // keep this new parameter and move on.
-                        cout << "Xaa" << char(x+64) << " adjusted to " << parameters.propensityX[x] << ". New SSDev = " << NewSumSquaredDev << endl;
-                        sumSquaredDev = NewSumSquaredDev;
-                        improved = true;
-                        improvedRound = true;
-                    }
-                }
-                if (not improved)
-                {
-                    parameters.propensityX[x] += delta;
-                    parameters.propensityX[x] += delta;
-                    NewSumSquaredDev = 0;
-                    if (parameters.propensityX[x] <= (parameters.exPropensityX[x] + maxDev)) // Only test this optimization if we are in range (2) of experimental values.
-                    {
-                        thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-                        thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-                        th1.join();
-                        th2.join();
-                        for (n=0; n<TotalHelices; n++)
-                        {
-                            //ScoreHelix(parameters, &Library[n]);
-                            NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                        }
-                        if (NewSumSquaredDev < sumSquaredDev)
-                        {
-                            // keep this new parameter and move on.
-                            cout << "Xaa" << char(x+64) << " adjusted to " << parameters.propensityX[x] << ". New SSDev = " << NewSumSquaredDev << endl;
-                            sumSquaredDev = NewSumSquaredDev;
-                            improved = true;
-                            improvedRound = true;
-                        }
-                    }
-                }
-                if (not improved)
-                {
-                    // neither change resulted in an improvement. Go back to original parameter.
-                    parameters.propensityX[x] -= delta;
-                    // cout << "Xaa" << x << ".  No changes resulted in an improvement." << endl;
-                }
-            }
-            improved = false;
-            
-            if (parameters.optPropY[x])
-            {
-                parameters.propensityY[x] -= delta;
-                NewSumSquaredDev = 0;
-                if (parameters.propensityY[x] >= (parameters.exPropensityY[x] - maxDev)) // Only test this optimization if we are in range (2) of experimental values.
-                    {
-                    thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-                    thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-                    th1.join();
-                    th2.join();
-                    for (n=0; n<TotalHelices; n++)
-                    {
-                        //ScoreHelix(parameters, &Library[n]);
-                        NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                        //if (abs(Library[n].deviation) > 1) NewSumSquaredDev += (abs(Library[n].deviation)-1);
-                    }
-                    if (NewSumSquaredDev < sumSquaredDev)
-                    {
-                        // keep this new parameter and move on.
-                        cout << "Yaa" << char(x+64) << " adjusted to " << parameters.propensityY[x] << ". New SSDev = " << NewSumSquaredDev << endl;
-                        sumSquaredDev = NewSumSquaredDev;
-                        improved = true;
-                        improvedRound = true;
-                    }
-                }
-                if (not improved)
-                {
-                    parameters.propensityY[x] += delta;
-                    parameters.propensityY[x] += delta;
-                    NewSumSquaredDev = 0;
-                    if (parameters.propensityY[x] <= (parameters.exPropensityY[x] + maxDev)) // Only test this optimization if we are in range (2) of experimental values.
-                    {
-                        thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-                        thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-                        th1.join();
-                        th2.join();
-                        for (n=0; n<TotalHelices; n++)
-                        {
-                            //ScoreHelix(parameters, &Library[n]);
-                            NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                            //if (abs(Library[n].deviation) > 1) NewSumSquaredDev += (abs(Library[n].deviation)-1);
-                        }
-                        if (NewSumSquaredDev < sumSquaredDev)
-                        {
-                            // keep this new parameter and move on.
-                            cout << "Yaa" << char(x+64) << " adjusted to " << parameters.propensityY[x] << ". New SSDev = " << NewSumSquaredDev << endl;
-                            sumSquaredDev = NewSumSquaredDev;
-                            improved = true;
-                            improvedRound = true;
-                        }
-                    }
-                }
-                if (not improved)
-                {
-                    // neither change resulted in an improvement. Go back to original parameter.
-                    parameters.propensityY[x] -= delta;
-                    // cout << "Yaa" << x << ".  No changes to this parameter resulted in an improvement." << endl;
-                }
-            }
-            improved = false;
-            
-            for (y=0;y<27;y++)
-            {
-                if (parameters.optAxial[x][y])
-                {
-                    parameters.axial[x][y] -= delta;
-                    NewSumSquaredDev = 0;
-                    if (parameters.axial[x][y] >= (parameters.exAxial[x][y] - maxDev)) // Only test this optimization if we are in range (2) of experimental values.
-                    {
-                        thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-                        thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-                        th1.join();
-                        th2.join();
-                        for (n=0; n<TotalHelices; n++)
-                        {
-                            // ScoreHelix(parameters, &Library[n]);
-                            NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                        }
-                        if (NewSumSquaredDev < sumSquaredDev)
-                        {
-                            // keep this new parameter and move on.
-                            cout << "axial" << char(x+64) << "," << char(y+64) << " adjusted to " << parameters.axial[x][y] << ".  New SSDev =  " << NewSumSquaredDev << endl;
-                            sumSquaredDev = NewSumSquaredDev;
-                            improved = true;
-                            improvedRound = true;
-                        }
-                    }
-                    if (not improved)
-                    {
-                        parameters.axial[x][y] += delta;
-                        parameters.axial[x][y] += delta;
-                        NewSumSquaredDev = 0;
-                        if (parameters.axial[x][y] <= (parameters.exAxial[x][y] + maxDev)) // Only test this optimization if we are in range (2) of experimental values.
-                            {
-                                thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-                                thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-                                th1.join();
-                                th2.join();
-                                for (n=0; n<TotalHelices; n++)
-                                {
-                                    // ScoreHelix(parameters, &Library[n]);
-                                    NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                                }
-                                if (NewSumSquaredDev < sumSquaredDev)
-                                {
-                                    // keep this new parameter and move on.
-                                    cout << "axial" << char(x+64) << "," << char(y+64) << " adjusted to " << parameters.axial[x][y] << ".  New SSDev =  " << NewSumSquaredDev << endl;
-                                    sumSquaredDev = NewSumSquaredDev;
-                                    improved = true;
-                                    improvedRound = true;
-                                }
-                        }
-                    }
-                    if (not improved)
-                    {
-                        // neither change resulted in an improvement. Go back to original parameter.
-                        parameters.axial[x][y] -= delta;
-                        // cout << "axial" << x << "," << y << ".  No changes to this parameter resulted in an improvement." << endl;
-                    }
-                }
-                improved = false;
-                
-                if (parameters.optLat[x][y])
-                {
-                    parameters.lateral[x][y] -= delta;
-                    NewSumSquaredDev = 0;
-                    if (parameters.lateral[x][y] >= (parameters.exLateral[x][y] - maxDev)) // Only test this optimization if we are in range (2) of experimental values.
-                        {
-                        // optimize this parameter (test slightly lower & slightly higher, pick the best)
-                        thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-                        thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-                        th1.join();
-                        th2.join();
-                        for (n=0; n<TotalHelices; n++)
-                        {
-                            //ScoreHelix(parameters, &Library[n]);
-                            NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                            //if (abs(Library[n].deviation) > 1) NewSumSquaredDev += (abs(Library[n].deviation)-1);
-                        }
-                        if (NewSumSquaredDev < sumSquaredDev)
-                        {
-                            // keep this new parameter and move on.
-                            cout << "lateral" << char(x+64) << "," << char(y+64) << " adjusted to " << parameters.lateral[x][y] << ".  New SSDev =  " << NewSumSquaredDev << endl;
-                            sumSquaredDev = NewSumSquaredDev;
-                            improved = true;
-                            improvedRound = true;
-                        }
-                    }
-                    if (not improved)
-                    {
-                        parameters.lateral[x][y] += delta;
-                        parameters.lateral[x][y] += delta;
-                        NewSumSquaredDev = 0;
-                        if (parameters.lateral[x][y] <= (parameters.exLateral[x][y] + maxDev)) // Only test this optimization if we are in range (2) of experimental values.
-                        {
-                            thread th1(ScoreLibrary, 0, TotalHelices/2, parameters, Library);
-                            thread th2(ScoreLibrary, TotalHelices/2, TotalHelices, parameters, Library);
-                            th1.join();
-                            th2.join();
-                            for (n=0; n<TotalHelices; n++)
-                            {
-                                //ScoreHelix(parameters, &Library[n]);
-                                NewSumSquaredDev += (Library[n].deviation * Library[n].deviation);
-                                //if (abs(Library[n].deviation) > 1) NewSumSquaredDev += (abs(Library[n].deviation)-1);
-                            }
-                            if (NewSumSquaredDev < sumSquaredDev)
-                            {
-                                // keep this new parameter and move on.
-                                cout << "lateral" << char(x+64) << "," << char(y+64) << " adjusted to " << parameters.lateral[x][y] << ".  New SSDev =  " << NewSumSquaredDev << endl;
-                                sumSquaredDev = NewSumSquaredDev;
-                                improved = true;
-                                improvedRound = true;
-                            }
-                        }
-                    }
-                    if (not improved)
-                    {
-                        // neither change resulted in an improvement. Go back to original parameter.
-                        parameters.lateral[x][y] -= delta;
-                        // cout << "lateral" << x << "," << y << ".  No changes to this parameter resulted in an improvement." << endl;
-                    }
-                }
-                improved = false;
-            }
+            FitParameters(parameters, libraryIndex, opt, maxRounds, parallelSearch);
+            sumSquaredDev = opt.sumSquaredDev;
         }
-            
-            if (not improvedRound) done = true;
-            improved = false;
-            improvedRound = false;
-            round++;
-            if (round >= maxRounds) done = true;
-            cout << "End round #" << round << ". Avg of SSDev = " << sumSquaredDev / TotalHelices << endl << endl;
-        } // end while loop
         time = clock() - time;
         
         cout << "Total time required: " << double(time)/CLOCKS_PER_SEC << endl;
@@ -2243,107 +6549,41 @@ int main (int argc, const char * argv[])
     if (useCase == 1)
     {
         // tell user about their peptide
-        ScoreHelix(parameters, &userHelix);
+        ScoreHelix(parameters, &userHelix, allOffsets);
         userHelix.dissect();
         userHelix.userOutput();
         
-        short poorPrediction = 0;
-        short poorAxList[27][27];
-        short poorLatList[27][27];
-        for (x=0;x<27;x++)for(y=0;y<27;y++)
-        {
-            poorAxList[x][y] = 0;
-            poorLatList[x][y] = 0;
-        }
-        short lowConfidenceCut = 25;
-        n = TotalHelices;
-        for (a=0;a<userHelix.numPep;a++) for (b=0;b<userHelix.numPep;b++)for (c=0;c<userHelix.numPep;c++)
-        {
-            for (x=0;x<userHelix.numAA;x++)
-            {
-                if (userHelix.isYaa(x))
-                {
-                    if ((x+2) < userHelix.numAA)
-                    {
-                        if (countInteractions.axial[short(userHelix.sequences[a][x])-64][short(userHelix.sequences[b][x+2])-64] < lowConfidenceCut)
-                        {
-                            poorPrediction++;
-                            poorAxList[short(userHelix.sequences[a][x])-64][short(userHelix.sequences[b][x+2])-64]++;
-                        }
-                    }
-                    if ((x+2) < userHelix.numAA)
-                    {
-                        if (countInteractions.axial[short(userHelix.sequences[b][x])-64][short(userHelix.sequences[c][x+2])-64] < lowConfidenceCut)
-                        {
-                            poorPrediction++;
-                            poorAxList[short(userHelix.sequences[b][x])-64][short(userHelix.sequences[c][x+2])-64]++;
-                        }
-                    }
-                    if ((x+5) < Library[n].numAA)
-                    {
-                        if (countInteractions.axial[short(userHelix.sequences[c][x])-64][short(userHelix.sequences[a][x+5])-64] < lowConfidenceCut)
-                        {
-                            poorPrediction++;
-                            poorAxList[short(userHelix.sequences[c][x])-64][short(userHelix.sequences[a][x+5])-64]++;
-                        }
-                    }
-                    if (x>1)
-                    {
-                        if (countInteractions.lateral[short(userHelix.sequences[a][x])-64][short(userHelix.sequences[b][x-1])-64] < lowConfidenceCut)
-                        {
-                            poorPrediction++;
-                            poorLatList[short(userHelix.sequences[a][x])-64][short(userHelix.sequences[b][x-1])-64]++;
-                        }
-                    }
-                    if (x>1)
-                    {
-                        if (countInteractions.lateral[short(userHelix.sequences[b][x])-64][short(userHelix.sequences[c][x-1])-64] < lowConfidenceCut)
-                        {
-                            poorPrediction++;
-                            poorLatList[short(userHelix.sequences[b][x])-64][short(userHelix.sequences[c][x-1])-64]++;
-                        }
-                    }
-                    if ((x+2) < Library[n].numAA)
-                    {
-                        if (countInteractions.lateral[short(userHelix.sequences[c][x])-64][short(userHelix.sequences[a][x+2])-64] < lowConfidenceCut)
-                        {
-                            poorPrediction++;
-                            poorLatList[short(userHelix.sequences[c][x])-64][short(userHelix.sequences[a][x+2])-64]++;
-                        }
-                    }
-                    
-                }
-            }
-        }
-        
-        cout << "Total Number of low confidence interactions in user helix: " << poorPrediction << "." << endl;
+        lowConfidenceList poor = LowConfidence(userHelix, interactions);
+        cout << "Total Number of low confidence interactions in user helix: " << poor.total << "." << endl;
         cout << "Note: this count is based on all possible intereactions in all possible canonical registers / compositions." << endl;
         
-        if (poorPrediction > 0)
+        if (poor.total > 0)
         {
             cout << "Low confidence Axial Interactions (shown as Yaa,Xaa):" << endl;
-            for (x=0;x<27;x++)for(y=0;y<27;y++)
+            for (x=0;x<(short)poor.pairs.size();x++)
             {
-                if (poorAxList[x][y] > 0)
-                {
-                    cout << char(x+64) << "," << char(y+64) << ": " << poorAxList[x][y] << endl;
-                }
+                if (poor.pairs[x].first/729 == axialInteraction) cout << char((poor.pairs[x].first/27)%27+64) << "," << char(poor.pairs[x].first%27+64) << ": " << poor.pairs[x].second << endl;
             }
             cout << endl;
             cout << "Low confidence Lateral Interactions (shown as Yaa,Xaa):" << endl;
-            for (x=0;x<27;x++)for(y=0;y<27;y++)
+            for (x=0;x<(short)poor.pairs.size();x++)
             {
-                if (poorLatList[x][y] > 0)
-                {
-                    cout << char(x+64) << "," << char(y+64) << ": " << poorLatList[x][y] << endl;
-                }
+                if (poor.pairs[x].first/729 == lateralInteraction) cout << char((poor.pairs[x].first/27)%27+64) << "," << char(poor.pairs[x].first%27+64) << ": " << poor.pairs[x].second << endl;
             }
         }
-        cout << "Would you like to change any amino acids? (Y/N)" << endl;
-        char Answer;
+        if (options.scan > 0) ReportMutations(userHelix, MutationScan(parameters, userHelix), options.scan);
+        
+        char Answer = 'N';
         short changeAA;
         short changePep;
-        cin >> Answer;
+        char newAA;
+        // The edits are scored in the background, as the GUI does, and waited for here.
+        helixSession session(parameters, userHelix, allOffsets);
+        if (options.peptides.size() == 0)
+        {
+            cout << "Would you like to change any amino acids? (Y/N)" << endl;
+            cin >> Answer;
+        }
         while ((Answer == 'Y') || (Answer == 'y'))
         {
             /*
@@ -2412,33 +6652,186 @@ int main (int argc, const char * argv[])
             cout << "Which # amino acid do you want to change?" << endl;
             cin >> changeAA;
             cout << "What should the new amino acid be? (single letter amino acid code)" << endl;
-            cin >> userHelix.sequences[changePep][changeAA];
-            ScoreHelix(parameters, &userHelix);
+            cin >> newAA;
+            sessionResult edited = session.Edit(changePep, changeAA, newAA).get();
+            if (not edited.applied) cout << "Peptide " << changePep << " has no amino acid #" << changeAA << "." << endl;
+            userHelix = *edited.helix;
                            userHelix.userOutput();
             cout << endl;
             cout << "Another change?" << endl;
             cin >> Answer;
         }
+        if (scoreCache.enabled) scoreCache.report();
+    }
+    
+    // Search for designs of the new helix that are more specific.
+    if (useCase == 5)
+    {
+        ScoreHelix(parameters, &userHelix, allOffsets);
+        userHelix.userOutput();
+        if (userHelix.numPep < 2) cout << "Only A2B and ABC heterotrimers can be designed for specificity." << endl;
+        else
+        {
+            // Wall time: the designs are scored on the pool, so clock() would add up the time of every thread.
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            short numPep = userHelix.numPep;
+            vector<designResult> designs = DesignSearch(parameters, userHelix, designBeam, designTop, [numPep] (const designResult & design)
+            {
+                cout << "New top design. ";
+                PrintDesign(design, numPep);
+            });
+            cout << endl << "The " << designs.size() << " most specific designs (" << SecondsSince(start) << " s):" << endl;
+            for (n=0;n<(short)designs.size();n++) PrintDesign(designs[n], numPep);
+        }
     }
         
     // Score "user_lib.txt"
     if (useCase == 2)
     {
-        totalUserHelices = readLibrary(userLib, "user_lib.txt");
-        ScoreLibrary(0, totalUserHelices, parameters, userLib);
+        // Streamed, so a library of any size is scored in the same memory.
+        ifstream user_input;
+        binaryFile user_binary;
+        long long binaryCount = 0;
+        const char * userRecords = NULL;
+        if (binaryInput && user_binary.open(BinaryName(options.userLibrary))) userRecords = user_binary.records(binaryLibraryMagic, sizeof(binaryHelix), binaryCount);
+        if (userRecords != NULL) totalUserHelices = binaryCount;
+        else totalUserHelices = OpenLibrary(user_input, options.userLibrary);
+        if (totalUserHelices < 0) totalUserHelices = 0;
         cout << "totalUserHelices = " << totalUserHelices << endl;
-        if (TotalHelices == 0)
+        if (totalUserHelices == 0)
         {
             cout << "totalUserHelices = " << totalUserHelices << ". Stopping." << endl;
             return 0;
         }
         cout << endl;
-        for (n=0; n<totalUserHelices; n++)
+        auto readHelix = [&] (long n, TripleHelix & theHelix, TripleHelix * previous)
+        {
+            if (userRecords != NULL)
+            {
+                binaryHelix packed;
+                memcpy(&packed, userRecords + n*sizeof(binaryHelix), sizeof(binaryHelix));
+                return UnpackHelix(packed, theHelix, BinaryName(options.userLibrary), n);
+            }
+            if (not ReadHelix(user_input, theHelix, previous, options.userLibrary, n)) return false;
+            theHelix.determine_reptition();
+            return true;
+        };
+        batchWriter records;
+        if (confidenceRecords) records.confidence = &interactions;
+        if (libraryFormat != consoleOutput)
+        {
+            if (libraryOutput == "")
+            {
+                if (libraryFormat == csvOutput) libraryOutput = "user_lib_scores.csv";
+                if (libraryFormat == jsonOutput) libraryOutput = "user_lib_scores.jsonl";
+                if (libraryFormat == binaryOutput) libraryOutput = "user_lib_scores.bin";
+            }
+            if (not records.open(libraryFormat, libraryOutput))
+            {
+                cout << "We couldn't open " << libraryOutput << ". Stopping." << endl;
+                return 0;
+            }
+        }
+        long scored = StreamLibrary(parameters, totalUserHelices, readHelix, allOffsets, [&] (long n, TripleHelix & theHelix)
+        {
+            if (libraryFormat == consoleOutput)
+            {
+                // theHelix.dissect();
+                cout << "User Helix #" << n+1 << endl;
+                theHelix.userOutput();
+            }
+            else records.write(n, theHelix);
+        });
+        records.close();
+        if ((libraryFormat != consoleOutput) && (libraryOutput != "-")) cout << scored << " scored helices written to " << libraryOutput << endl;
+        if (scoreCache.enabled) scoreCache.report();
+    }
+    
+    // Write the binary forms of the parameter and library files. The text files are left as they are.
+    if (useCase == 4)
+    {
+        long converted;
+        string binaryName = BinaryName(options.parameterFile);
+        if (WriteBinaryParameters(parameters, binaryName)) cout << "Parameters written to " << binaryName << endl;
+        else cout << "We couldn't write " << binaryName << "." << endl;
+        binaryName = BinaryName(options.trainingLibrary);
+        converted = ConvertLibrary(options.trainingLibrary, binaryName);
+        if (converted >= 0) cout << converted << " helices written to " << binaryName << endl;
+        binaryName = BinaryName(options.userLibrary);
+        converted = ConvertLibrary(options.userLibrary, binaryName);
+        if (converted >= 0) cout << converted << " helices written to " << binaryName << endl;
+        binaryName = CountsName(options.trainingLibrary);
+        if (WriteInteractionCounts(interactions, binaryName)) cout << interactions.counts.size() << " interaction counts written to " << binaryName << endl;
+        else cout << "We couldn't write " << binaryName << "." << endl;
+    }
+    
+    // Check the linear pairwise solver against the original recursion on the training library.
+    if (useCase == 3)
+    {
+        if (CheckPairWiseCalc(parameters, Library, TotalHelices)) cout << "PairWiseCalc matches the recursion on every interaction thread." << endl;
+        else cout << "\x1b[1m\x1b[31mWARNING: PairWiseCalc does not match the recursion.\x1b[0m" << endl;
+        if (CheckHelixSession(parameters, Library, TotalHelices)) cout << "The background session answers every request." << endl;
+        else cout << "\x1b[1m\x1b[31mWARNING: the background session left a request unanswered.\x1b[0m" << endl;
+    }
+    
+    if (useCase == 6) RunBenchmarks(parameters, Library, TotalHelices, libraryIndex, options.trainingLibrary, delta, maxDev);
+    
+    // Score the training library under the parameters, their experimental values and every --set file at once.
+    if (useCase == 7)
+    {
+        parameterType experimental = parameters;
+        for (x=0;x<27;x++)
+        {
+            experimental.propensityX[x] = parameters.exPropensityX[x];
+            experimental.propensityY[x] = parameters.exPropensityY[x];
+            for (y=0;y<27;y++)
+            {
+                experimental.axial[x][y] = parameters.exAxial[x][y];
+                experimental.lateral[x][y] = parameters.exLateral[x][y];
+            }
+        }
+        experimental.A = parameters.exA;
+        experimental.B = parameters.exB;
+        experimental.C = parameters.exC;
+        experimental.version = NextParameterVersion();
+        vector<parameterType> extraSets(options.parameterSets.size());
+        for (n=0;n<(short)extraSets.size();n++) extraSets[n] = ReadParameters(options.parameterSets[n], options.experimentalFile, options.optimizationFile);
+        
+        parameterSets sets;
+        sets.add(parameters, options.parameterFile);
+        sets.add(experimental, options.experimentalFile);
+        for (n=0;n<(short)extraSets.size();n++) sets.add(extraSets[n], options.parameterSets[n]);
+        sets.arrange();
+        
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<setScore> scores = ScoreLibrarySets(sets, Library, TotalHelices, allOffsets);
+        cout << TotalHelices << " helices scored under " << sets.count << " parameter sets in " << SecondsSince(start) << " s." << endl;
+        WriteSetScores(sets, Library, TotalHelices, scores, (libraryOutput == "") ? "parameter_sets.csv" : libraryOutput);
+    }
+    
+    // Fit the parameters to parts of the training library and test them on the rest.
+    if (useCase == 8) ValidateFit(parameters, Library, TotalHelices, validationFolds, bootstrapSamples, allOffsets, delta, maxDev, maxRounds, parallelSearch);
+    
+    // Stay resident and score the helices sent to us.
+    if (useCase == 9)
+    {
+#ifdef SCEPTTR_SOCKETS
+        if (options.socket != "")
         {
-            // userLib[n].dissect();
-            cout << "User Helix #" << n+1 << endl;
-            userLib[n].userOutput();
+            ServeSocket(parameters, allOffsets, confidenceRecords ? &interactions : NULL, options.socket);
+            return 1;
         }
+#else
+        if (options.socket != "") cout << "--socket isn't available on this system, so the standard input is served instead." << endl;
+#endif
+        ostream answers(answerOutput);
+        cout << "Ready for helices on the standard input." << endl;
+        long served = ServeRequests(parameters, allOffsets, confidenceRecords ? &interactions : NULL, [] (string & line) { return bool(GetLine(cin, line)); }, [&answers] (const string & records)
+        {
+            answers << records << flush;
+        });
+        cout << served << " helices scored." << endl;
+        if (scoreCache.enabled) scoreCache.report();
     }
     
 } // end main()